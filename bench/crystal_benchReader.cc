@@ -0,0 +1,168 @@
+// crystal_benchReader.cc - Benchmark of the Giessen LT ingest path of crystal_dataReader.cc.
+//
+// Times each stage of a read (crystal_stages.h): open (mmap), header parse, body parse, bef/irr
+// pairing, deltaK, and write (the binary sidecar of crystal_cache.h, which needs no ROOT). For every configuration it
+// prints the best wall time of each stage over the repeats, parse throughput in MB/s and scans/s,
+// and the peak RSS. Each configuration runs in its own process, so the peak RSS is its own.
+//
+// Without file arguments, synthetic files (crystal_synthetic.h) are generated in $TMPDIR for every
+// combination of the -s and -w lists, so the numbers are reproducible on any Linux box.
+//
+//   g++ -O3 -pthread -I.. -o crystal_benchReader crystal_benchReader.cc
+//   ./crystal_benchReader [-s 100,400,1600] [-w 1151] [-n 5] [file.csv ...]
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "crystal_cache.h"
+#include "crystal_csvReader.h"
+#include "crystal_deltaK.h"
+#include "crystal_pairing.h"
+#include "crystal_spectra.h"
+#include "crystal_stages.h"
+#include "crystal_synthetic.h"
+
+
+static std::vector<int> benchParseList(const char* s)
+{
+  std::vector<int> v;
+  while (*s) {
+    char* e;
+    long x = std::strtol(s, &e, 10);
+    if (e == s) break;
+    if (x > 0) v.push_back(x);
+    s = *e == ',' ? e + 1 : e;
+  }
+  return v;
+}
+
+// One read of path through every stage; t receives the wall time per stage
+static bool benchOnce(const char* path, const std::string& sidecar, double* t, CrystalCSVInfo& info, int& npair)
+{
+  double t0 = crystalNow();
+  CrystalMappedFile file(path);
+  if (!file.IsOpen()) return false;
+  t[kStageOpen] = crystalNow() - t0;
+
+  t0 = crystalNow();
+  info = CrystalCSVInfo();
+  info.nbytes = file.Size();
+  std::vector<std::pair<int, int> > names;
+  const char* body = parseGiessenHeader(file.Begin(), file.End(), info, names);
+  t[kStageHeader] = crystalNow() - t0;
+
+  t0 = crystalNow();
+  CrystalSpectra spectra;
+  spectra.Resize(info.nscan, crystalCountLines(body, file.End()));
+  for (int i = 0; i < info.nscan; i++) spectra.SetScan(i, names[i].first, names[i].second);
+  parseGiessenBody(body, file.End(), info, spectra);
+  t[kStageBody] = crystalNow() - t0;
+
+  t0 = crystalNow();
+  CrystalPairing pairing(spectra);
+  std::vector<CrystalPair> pairs = pairing.Pairs();
+  t[kStagePairing] = crystalNow() - t0;
+  npair = pairs.size();
+
+  t0 = crystalNow();
+  CrystalDeltaK deltaK;
+  deltaK.Compute(spectra, pairs, 0.2);
+  t[kStageCompute] = crystalNow() - t0;
+
+  t0 = crystalNow();
+  crystalWriteCache(sidecar, 0, info, spectra);
+  t[kStageWrite] = crystalNow() - t0;
+  return true;
+}
+
+static int benchFile(const char* path, int repeats)
+{
+  const std::string sidecar = std::string(path) + ".bench.ltcache";
+  double best[kNStage];
+  CrystalCSVInfo info;
+  int npair = 0;
+  for (int r = 0; r < repeats; r++) {
+    double t[kNStage];
+    if (!benchOnce(path, sidecar, t, info, npair)) {
+      std::fprintf(stderr, "cannot open %s\n", path);
+      return 1;
+    }
+    for (int s = 0; s < kNStage; s++) best[s] = r == 0 || t[s] < best[s] ? t[s] : best[s];
+  }
+  std::remove(sidecar.c_str());
+
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  double total = 0;
+  for (int s = 0; s < kNStage; s++) total += best[s];
+  const double parse = best[kStageHeader] + best[kStageBody];
+  const double mb = info.nbytes / 1e6;
+
+  std::printf("%s: %d scans x %d wavelengths, %.1f MB, %d pairs, %ld bad cells\n", path, info.nscan, info.nrow, mb,
+              npair, info.nbad);
+  for (int s = 0; s < kNStage; s++) std::printf("  %-8s %10.3f ms\n", crystalStageName(s), 1e3 * best[s]);
+  std::printf("  %-8s %10.3f ms\n", "total", 1e3 * total);
+  std::printf("  parse    %10.1f MB/s  %10.0f scans/s\n", parse > 0 ? mb / parse : 0., parse > 0 ? info.nscan / parse : 0.);
+  std::printf("  peak RSS %10.1f MB\n", ru.ru_maxrss / 1024.);
+  std::fflush(stdout);
+  return 0;
+}
+
+// Run f in a child process so that its peak RSS is not mixed with the other configurations
+template <class F> static int benchIsolated(F f)
+{
+  std::fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) return f();
+  if (pid == 0) _exit(f());
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+
+int main(int argc, char** argv)
+{
+  std::vector<int> nscans(1, 400), nwls(1, 1151);
+  int repeats = 5;
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    if (a == "-s" && i + 1 < argc) nscans = benchParseList(argv[++i]);
+    else if (a == "-w" && i + 1 < argc) nwls = benchParseList(argv[++i]);
+    else if (a == "-n" && i + 1 < argc) repeats = std::atoi(argv[++i]);
+    else if (a[0] == '-') {
+      std::fprintf(stderr, "usage: %s [-s nscan,...] [-w nwl,...] [-n repeats] [file.csv ...]\n", argv[0]);
+      return 2;
+    }
+    else files.push_back(argv[i]);
+  }
+  if (repeats < 1) repeats = 1;
+  std::printf("best of %d runs per configuration (file in page cache after the first)\n", repeats);
+
+  int failed = 0;
+  for (size_t i = 0; i < files.size(); i++)
+    failed += benchIsolated([&]() { return benchFile(files[i], repeats); }) != 0;
+  if (!files.empty()) return failed ? 1 : 0;
+
+  const char* tmpdir = std::getenv("TMPDIR");
+  for (size_t is = 0; is < nscans.size(); is++) {
+    for (size_t iw = 0; iw < nwls.size(); iw++) {
+      std::string path = std::string(tmpdir ? tmpdir : "/tmp") + "/crystal_bench_" + std::to_string(nscans[is]) + "x" +
+                         std::to_string(nwls[iw]) + "_" + std::to_string((long)getpid()) + ".csv";
+      if (crystalWriteSynthetic(path.c_str(), nscans[is], nwls[iw]) <= 0) {
+        std::fprintf(stderr, "cannot write %s\n", path.c_str());
+        return 1;
+      }
+      failed += benchIsolated([&]() { return benchFile(path.c_str(), repeats); }) != 0;
+      std::remove(path.c_str());
+    }
+  }
+  return failed ? 1 : 0;
+}
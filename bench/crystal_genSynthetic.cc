@@ -0,0 +1,28 @@
+// crystal_genSynthetic.cc - Writes a synthetic Giessen LT csv file (see crystal_synthetic.h).
+//
+//   g++ -O2 -o crystal_genSynthetic crystal_genSynthetic.cc
+//   ./crystal_genSynthetic out.csv [nscan=400] [nwl=1151] [seed=1]
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "crystal_synthetic.h"
+
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    std::fprintf(stderr, "usage: %s out.csv [nscan=400] [nwl=1151] [seed=1]\n", argv[0]);
+    return 2;
+  }
+  int nscan = argc > 2 ? std::atoi(argv[2]) : 400;
+  int nwl   = argc > 3 ? std::atoi(argv[3]) : 1151;
+  long seed = argc > 4 ? std::atol(argv[4]) : 1;
+  long size = crystalWriteSynthetic(argv[1], nscan, nwl, seed);
+  if (size <= 0) {
+    std::fprintf(stderr, "failed to write %s\n", argv[1]);
+    return 1;
+  }
+  std::printf("%s: %d scans x %d wavelengths, %ld bytes\n", argv[1], nscan, nwl, size);
+  return 0;
+}
@@ -0,0 +1,80 @@
+// crystal_synthetic.h - Synthetic Giessen LT files for benchmarking crystal_dataReader.cc.
+//
+// Writes a file in exactly the layout the reader expects (see crystal_csvReader.h): the trace count,
+// a header of PbWO_NNN_bef / PbWO_NNN_irr names (all bef scans first, then the irr scans of the same
+// crystals, as in the production files) and one row per wavelength of alternating wl / LT columns.
+// The grid runs from 900 nm down to 325 nm, so nwl = 1151 reproduces the 0.5 nm production grid.
+// LT follows a smooth absorption-edge curve with noise; irr scans add an induced absorption band
+// around 420 nm. The output depends only on the arguments and the seed.
+
+#ifndef CRYSTAL_SYNTHETIC_H
+#define CRYSTAL_SYNTHETIC_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+
+// Simple 64-bit generator so that files are identical across platforms and compilers
+struct CrystalSyntheticRandom {
+  uint64_t state;
+  explicit CrystalSyntheticRandom(uint64_t seed) : state(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+  double Uniform()   // [0, 1)
+  {
+    state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+    return (state >> 11) * (1.0 / 9007199254740992.0);
+  }
+};
+
+// Write nscan traces (nscan/2 crystals measured bef and irr; odd nscan adds one unpaired bef scan)
+// on nwl wavelengths to path. Returns the number of bytes written, 0 on failure.
+inline long crystalWriteSynthetic(const char* path, int nscan, int nwl, uint64_t seed = 1)
+{
+  FILE* f = std::fopen(path, "w");
+  if (!f || nscan <= 0 || nwl <= 1) {
+    if (f) std::fclose(f);
+    return 0;
+  }
+  std::vector<char> buffer(1 << 20);
+  std::setvbuf(f, buffer.data(), _IOFBF, buffer.size());
+
+  const int npair = nscan / 2;
+  std::vector<int> crystal(nscan), irr(nscan);
+  for (int i = 0; i < nscan; i++) {
+    const bool isIrr = i >= nscan - npair;
+    crystal[i] = 1 + (isIrr ? i - (nscan - npair) : i);
+    irr[i] = isIrr;
+  }
+
+  // per crystal: plateau transmission, edge position and induced absorption (1/m) at the band peak
+  CrystalSyntheticRandom rng(seed);
+  std::vector<double> plateau(nscan), edge(nscan), dk(nscan);
+  for (int i = 0; i < nscan; i++) {
+    plateau[i] = 68 + 4 * rng.Uniform();
+    edge[i]    = 345 + 10 * rng.Uniform();
+    dk[i]      = 0.2 + 1.2 * rng.Uniform();
+  }
+
+  std::fprintf(f, "%d\n", nscan);
+  for (int i = 0; i < nscan; i++) std::fprintf(f, "%sPbWO_%03d_%s", i ? " " : "", crystal[i], irr[i] ? "irr" : "bef");
+  std::fprintf(f, "\n");
+
+  const double length = 0.2;
+  for (int r = 0; r < nwl; r++) {
+    const double wl = 900. - 575. * r / (nwl - 1);
+    for (int i = 0; i < nscan; i++) {
+      const int c = crystal[i] - 1;   // bef and irr scans of a crystal share its parameters
+      double lt = plateau[c] / (1 + std::exp(-(wl - edge[c]) / 6.));
+      if (irr[i]) lt *= std::exp(-length * dk[c] * std::exp(-0.5 * std::pow((wl - 420.) / 60., 2)));
+      lt += 0.05 * (rng.Uniform() - 0.5);
+      std::fprintf(f, "%s%.1f %.4f", i ? " " : "", wl, lt);
+    }
+    std::fprintf(f, "\n");
+  }
+  long size = std::ftell(f);
+  if (std::fclose(f) != 0) return 0;
+  return size;
+}
+
+#endif
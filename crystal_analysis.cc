@@ -0,0 +1,298 @@
+// crystal_analysis.cc - Multithreaded analysis of the Giessen LT tree written by crystal_dataReader.cc.
+//
+// Runs over the "pairs" tree (one entry per crystal with its bef and irr spectra, crystal_pairsWriter.h)
+// with RDataFrame and implicit multithreading. Every quantity is a lazy column of the data frame:
+//   dk              deltaK spectrum, (1/length) ln(LT_bef/LT_irr), NaN where either LT <= 0
+//   <band>_bef/irr  LT at the evaluation bands (LT360, LT420, LT620; crystal_wavelength.h)
+//   <band>_ratio    LT_irr / LT_bef at the band
+//   <band>_dk       deltaK at the band
+// and every output is booked before the single event loop runs, so a whole campaign is analysed in
+// one pass over the data on all cores:
+//   tree "analysis"          crystal, bef, irr and the band columns, one entry per pair (entry order
+//                            follows the threads, not the input)
+//   h_<band>_dk              deltaK distribution (automatic range, valid points only)
+//   h_<band>_ratio           LT_irr / LT_bef distribution
+//   h_<band>_bef_irr         LT_irr vs LT_bef
+//   p_dk_wl                  mean deltaK vs wavelength over all crystals
+//
+// Run as a macro (root -l 'crystal_analysis.cc("crystal_LT.root")'), or build with "make" and run
+// ./crystal_analysis --help.
+
+#include <ROOT/RDataFrame.hxx>
+#include <ROOT/RVec.hxx>
+#include <TFile.h>
+#include <TH1D.h>
+#include <TH2D.h>
+#include <TProfile.h>
+#include <TROOT.h>
+#include <TVectorD.h>
+
+#include <cmath>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "crystal_log.h"
+#include "crystal_stages.h"
+#include "crystal_treeWriter.h"
+#include "crystal_wavelength.h"
+
+using namespace std;
+
+typedef ROOT::VecOps::RVec<double> CrystalRVec;
+
+
+// Run configuration, filled from the macro arguments or from the command line of the compiled analysis
+struct CrystalAnalysisOptions {
+  string inFile;      // output of crystal_dataReader.cc, with the "pairs" tree
+  string outFile;     // analysis tree and histograms
+  double length;      // crystal length (m) used for deltaK
+  int    nThreads;    // implicit MT threads, 0 == one per core, 1 == sequential
+  int    logLevel;    // ECrystalLogLevel (crystal_log.h)
+  string statsFile;   // per-stage timing summary as JSON, "-" for stdout, empty for none (crystal_stages.h)
+
+  CrystalAnalysisOptions() : inFile("crystal_LT.root"), outFile("crystal_LT_analysis.root"), length(0.2), nThreads(0), logLevel(kLogInfo) {}
+};
+
+// Exit codes of runCrystalAnalysis() and of the compiled analysis
+enum ECrystalAnalysisExit {
+  kAnalysisOk          = 0,
+  kAnalysisNoInput     = 1,   // input file, "pairs" tree or wavelength grid missing
+  kAnalysisUsage       = 2,   // bad command line
+  kAnalysisOutputError = 3    // output file could not be written
+};
+
+
+// Band value of a spectrum from precomputed weights; NaN for a band outside the grid
+double crystalBandValue(const CrystalBandWeights& w, const CrystalRVec& spectrum)
+{
+  if (!w.valid) return numeric_limits<double>::quiet_NaN();
+  double sum = 0;
+  for (size_t k = 0; k < w.row.size(); k++) sum += w.weight[k] * spectrum[w.row[k]];
+  return sum;
+}
+
+
+int runCrystalAnalysis(const CrystalAnalysisOptions& opt)
+{
+    crystalLogger().SetLevel(opt.logLevel);
+    CrystalStageTimer stages;
+
+    // wavelength grid of the reader output
+    double t0 = crystalNow();
+    vector<double> wl;
+    bool havePairs = false;
+    CrystalTreeConfig storage;   // of the LT arrays, for the fixed-point NaN code (crystal_treeWriter.h)
+    {
+      TFile* in = TFile::Open(opt.inFile.c_str(), "READ");
+      if (in && !in->IsZombie()) {
+        TVectorD* wavelength = dynamic_cast<TVectorD*>(in->Get("wavelength"));
+        if (wavelength) wl.assign(wavelength->GetMatrixArray(), wavelength->GetMatrixArray() + wavelength->GetNrows());
+        TTree* pairs = dynamic_cast<TTree*>(in->Get("pairs"));
+        havePairs = pairs != 0;
+        TBranch* branch = pairs ? pairs->GetBranch("lt_bef") : 0;
+        if (branch) crystalParseLeafStorage(branch->GetTitle(), storage);
+        delete wavelength;
+      }
+      delete in;
+    }
+    stages.Add(kStageOpen, crystalNow() - t0, 0, wl.size());
+    if (wl.empty() || !havePairs) {
+      CRYSTAL_LOG(kLogQuiet) << "No wavelength grid or pairs tree in " << opt.inFile << " (written by crystal_dataReader.cc)";
+      CRYSTAL_LOG(kLogInfo) << "Stages:\n" << stages.Format();
+      return kAnalysisNoInput;
+    }
+    const int nwl = wl.size();
+    CrystalWavelengthIndex index(wl.data(), nwl);
+    if (!index.IsValid()) CRYSTAL_LOG(kLogQuiet) << "Warning: wavelength grid is not monotonic, no band values";
+
+    if (opt.nThreads != 1) ROOT::EnableImplicitMT(opt.nThreads > 0 ? opt.nThreads : 0);
+    ROOT::RDataFrame frame("pairs", opt.inFile);
+
+    // lazy columns: deltaK spectrum, then LT, ratio and deltaK at every band. Fixed-point LT arrays
+    // are decoded first, so the reserved NaN code does not read as an LT value.
+    const double invLength = 1. / opt.length;
+    const CrystalRVec wlColumn(wl.begin(), wl.end());
+    ROOT::RDF::RNode df = frame;
+    string befColumn = "lt_bef", irrColumn = "lt_irr";
+    if (storage.storage == kStorageFixed) {
+      auto decode = [storage](const CrystalRVec& lt) {
+          CrystalRVec v(lt.begin(), lt.end());
+          crystalDecodeLT(storage, v.data(), v.size());
+          return v;
+        };
+      df = df.Define("lt_bef_decoded", decode, { "lt_bef" }).Define("lt_irr_decoded", decode, { "lt_irr" });
+      befColumn = "lt_bef_decoded";
+      irrColumn = "lt_irr_decoded";
+    }
+    df = df
+      .Define("dk", [invLength](const CrystalRVec& bef, const CrystalRVec& irr) {
+          CrystalRVec dk(bef.size());
+          for (size_t j = 0; j < bef.size(); j++)
+            dk[j] = bef[j] > 0 && irr[j] > 0 ? invLength * std::log(bef[j] / irr[j]) : numeric_limits<double>::quiet_NaN();
+          return dk;
+        }, { befColumn, irrColumn })
+      // wavelengths and deltaK of the valid points, for the deltaK profile
+      .Define("dk_wl", [wlColumn](const CrystalRVec& dk) { return wlColumn[dk == dk]; }, { "dk" })
+      .Define("dk_valid", [](const CrystalRVec& dk) { return dk[dk == dk]; }, { "dk" });
+
+    vector<CrystalBand> bands = crystalDefaultBands();
+    vector<string> columns = { "crystal", "bef", "irr" };
+    for (size_t ib = 0; ib < bands.size(); ib++) {
+      const CrystalBandWeights w = crystalBandWeights(index, bands[ib]);
+      const string name = bands[ib].name;
+      auto band = [w](const CrystalRVec& spectrum) { return crystalBandValue(w, spectrum); };
+      df = df.Define(name + "_bef", band, { befColumn })
+             .Define(name + "_irr", band, { irrColumn })
+             .Define(name + "_dk",  band, { "dk" })
+             .Define(name + "_ratio", [](double bef, double irr) { return bef > 0 ? irr / bef : numeric_limits<double>::quiet_NaN(); },
+                     { name + "_bef", name + "_irr" });
+      columns.push_back(name + "_bef");
+      columns.push_back(name + "_irr");
+      columns.push_back(name + "_ratio");
+      columns.push_back(name + "_dk");
+    }
+
+    // book every output, then run the one event loop
+    auto count = df.Count();
+    vector<ROOT::RDF::RResultPtr<TH1D> > hDK, hRatio;
+    vector<ROOT::RDF::RResultPtr<TH2D> > hBefIrr;
+    for (size_t ib = 0; ib < bands.size(); ib++) {
+      const string name = bands[ib].name;
+      // NaN (LT <= 0) kept out of the automatic range
+      auto finite = [](double v) { return std::isfinite(v); };
+      hDK.push_back(df.Filter(finite, { name + "_dk" })
+                      .Histo1D({ ("h_" + name + "_dk").c_str(), (name + " deltaK;deltaK (1/m);crystals").c_str(), 100, 0., 0. }, name + "_dk"));
+      hRatio.push_back(df.Filter(finite, { name + "_ratio" })
+                         .Histo1D({ ("h_" + name + "_ratio").c_str(), (name + " LT_{irr}/LT_{bef};ratio;crystals").c_str(), 120, 0., 1.2 },
+                                  name + "_ratio"));
+      hBefIrr.push_back(df.Histo2D({ ("h_" + name + "_bef_irr").c_str(), (name + ";LT_{bef} (%);LT_{irr} (%)").c_str(), 110, 0., 110., 110, 0., 110. },
+                                   name + "_bef", name + "_irr"));
+    }
+    const double step = nwl > 1 ? fabs(index.Max() - index.Min()) / (nwl - 1) : 1.;
+    auto pDK = df.Profile1D({ "p_dk_wl", "Mean deltaK;wavelength (nm);deltaK (1/m)", nwl, index.Min() - step / 2, index.Max() + step / 2 },
+                            "dk_wl", "dk_valid");
+    ROOT::RDF::RSnapshotOptions snapshotOptions;
+    snapshotOptions.fLazy = true;
+    auto snapshot = df.Snapshot("analysis", opt.outFile, columns, snapshotOptions);
+
+    t0 = crystalNow();
+    const ULong64_t npair = *count;   // runs the event loop: fills all of the above and writes the snapshot
+    stages.Add(kStageCompute, crystalNow() - t0, 2. * npair * nwl * sizeof(double), (double)npair * nwl);
+    CRYSTAL_LOG(kLogInfo) << "Analysed " << npair << " pairs x " << nwl << " wavelengths in " << frame.GetNRuns() << " event loop(s) on "
+                          << (ROOT::IsImplicitMTEnabled() ? ROOT::GetThreadPoolSize() : 1) << " thread(s)";
+
+    t0 = crystalNow();
+    TFile* out = TFile::Open(opt.outFile.c_str(), "UPDATE");
+    if (!out || out->IsZombie()) {
+      delete out;
+      CRYSTAL_LOG(kLogQuiet) << "Output file failed to open: " << opt.outFile;
+      return kAnalysisOutputError;
+    }
+    TVectorD wavelength(nwl);
+    for (int j = 0; j < nwl; j++) wavelength[j] = wl[j];
+    wavelength.Write("wavelength", TObject::kOverwrite);
+    for (size_t ib = 0; ib < bands.size(); ib++) {
+      hDK[ib]->Write("", TObject::kOverwrite);
+      hRatio[ib]->Write("", TObject::kOverwrite);
+      hBefIrr[ib]->Write("", TObject::kOverwrite);
+      CRYSTAL_LOG(kLogInfo) << bands[ib].name << " : deltaK mean " << hDK[ib]->GetMean() << " rms " << hDK[ib]->GetRMS()
+                            << " 1/m, LT_irr/LT_bef mean " << hRatio[ib]->GetMean();
+    }
+    pDK->Write("", TObject::kOverwrite);
+    out->Close();
+    delete out;
+    stages.Add(kStageWrite, crystalNow() - t0, 0, 3 * bands.size() + 1);
+    CRYSTAL_LOG(kLogInfo) << "Wrote analysis tree and histograms to " << opt.outFile;
+
+    CRYSTAL_LOG(kLogInfo) << "Stages:\n" << stages.Format();
+    crystalLogger().Flush();
+    if (!opt.statsFile.empty() && !stages.WriteJSON(opt.statsFile))
+      CRYSTAL_LOG(kLogQuiet) << "Warning: stage summary could not be written to " << opt.statsFile;
+    return kAnalysisOk;
+}
+
+
+// Macro entry point
+// inFile   : ROOT file written by crystal_dataReader.cc
+// outFile  : analysis tree and histograms
+// length   : crystal length in m
+// nThreads : implicit MT threads, 0 == one per core, 1 == sequential
+int crystal_analysis(const char* inFile = "crystal_LT.root", const char* outFile = "crystal_LT_analysis.root",
+                     double length = 0.2, int nThreads = 0)
+{
+  CrystalAnalysisOptions opt;
+  opt.inFile = inFile;
+  opt.outFile = outFile;
+  opt.length = length;
+  opt.nThreads = nThreads;
+  return runCrystalAnalysis(opt);
+}
+
+
+#ifdef CRYSTAL_STANDALONE
+// Compiled, batch-mode analysis (see Makefile):
+//   crystal_analysis [options] [crystal_LT.root]
+
+#include <getopt.h>
+
+static void crystalAnalysisUsage(const char* prog)
+{
+  cerr << "usage: " << prog << " [options] [crystal_LT.root]\n"
+       << "  -o, --output FILE       analysis tree and histograms (crystal_LT_analysis.root)\n"
+       << "  -l, --length M          crystal length in m for deltaK (0.2)\n"
+       << "  -j, --threads N         implicit MT threads, 0 == one per core, 1 == sequential (0)\n"
+       << "  -q, --quiet             warnings and errors only\n"
+       << "  -v, --verbose           debug output\n"
+       << "      --log-level L       quiet, info or debug (info)\n"
+       << "      --stats FILE        per-stage timing summary as JSON, - for stdout\n"
+       << "  -h, --help              this message\n";
+}
+
+int main(int argc, char** argv)
+{
+  CrystalAnalysisOptions opt;
+  enum { kLogLevel = 256, kStats };
+  static const struct option longopts[] = {
+    { "output",    required_argument, 0, 'o' },
+    { "length",    required_argument, 0, 'l' },
+    { "threads",   required_argument, 0, 'j' },
+    { "quiet",     no_argument,       0, 'q' },
+    { "verbose",   no_argument,       0, 'v' },
+    { "log-level", required_argument, 0, kLogLevel },
+    { "stats",     required_argument, 0, kStats },
+    { "help",      no_argument,       0, 'h' },
+    { 0, 0, 0, 0 }
+  };
+  int c;
+  while ((c = getopt_long(argc, argv, "o:l:j:qvh", longopts, 0)) != -1) {
+    char* end = 0;
+    switch (c) {
+    case 'o': opt.outFile = optarg; break;
+    case 'l': opt.length = strtod(optarg, &end); break;
+    case 'j': opt.nThreads = strtol(optarg, &end, 10); break;
+    case 'q': opt.logLevel = kLogQuiet; break;
+    case 'v': opt.logLevel = kLogDebug; break;
+    case kLogLevel:
+      if (!crystalParseLogLevel(optarg, opt.logLevel)) end = optarg;
+      break;
+    case kStats: opt.statsFile = optarg; break;
+    case 'h': crystalAnalysisUsage(argv[0]); return kAnalysisOk;
+    default: crystalAnalysisUsage(argv[0]); return kAnalysisUsage;
+    }
+    if (end && (*end || end == optarg)) {
+      cerr << argv[0] << ": bad value '" << optarg << "'" << endl;
+      return kAnalysisUsage;
+    }
+  }
+  if (optind < argc) opt.inFile = argv[optind++];
+  if (optind < argc || !(opt.length > 0) || opt.nThreads < 0) {
+    crystalAnalysisUsage(argv[0]);
+    return kAnalysisUsage;
+  }
+
+  gROOT->SetBatch(kTRUE);
+  return runCrystalAnalysis(opt);
+}
+#endif
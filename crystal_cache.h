@@ -0,0 +1,233 @@
+// crystal_cache.h - Binary sidecar cache for parsed Giessen LT files.
+//
+// The first time a csv file is read, its parsed header (crystal numbers, status) and spectra are
+// written next to it as "<file>.ltcache" (or into CrystalCacheConfig::dir). The sidecar is keyed by a
+// 64-bit hash of the file contents and of the parse settings, so later reads of the unchanged file
+// load the arrays straight into the CrystalSpectra store; a changed file, a changed parser or a
+// damaged sidecar gives a key or size mismatch and the text is parsed again.
+//
+// Sidecar layout (native byte order, checked on load):
+//   char[8] magic "PWOLTC02", uint32 byte order mark, uint32 header size, uint64 key,
+//   int32 nscanFile, nscan, nrow, ndiag, int64 nbad,
+//   int32 crystal[nscan], int32 status[nscan], double wl[nrow], double lt[nscan][nrow],
+//   int64 count[kNDiagnostic], CrystalCSVDiagnostic diag[ndiag]
+// The parse diagnostics are kept so that a file loaded from its sidecar reports the same problems.
+//
+// If a sidecar cannot be written (a read-only or shared data directory without CrystalCacheConfig::dir),
+// the first failure is flagged in that file's CrystalCSVInfo and no further sidecars are written
+// through the same config; sidecars that already exist are still loaded.
+
+#ifndef CRYSTAL_CACHE_H
+#define CRYSTAL_CACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "crystal_csvReader.h"
+#include "crystal_spectra.h"
+
+
+struct CrystalCacheConfig {
+  bool        enabled;
+  std::string dir;       // where sidecars are kept; empty == next to the csv file
+  mutable std::atomic<bool> readOnly;   // set by the first sidecar that could not be written
+
+  CrystalCacheConfig(bool on = false, const std::string& d = "") : enabled(on), dir(d), readOnly(false) {}
+  CrystalCacheConfig(const CrystalCacheConfig& o) : enabled(o.enabled), dir(o.dir), readOnly(o.readOnly.load()) {}
+  CrystalCacheConfig& operator=(const CrystalCacheConfig& o)
+  {
+    enabled = o.enabled;
+    dir = o.dir;
+    readOnly = o.readOnly.load();
+    return *this;
+  }
+};
+
+
+// 64-bit hash (four interleaved multiply-rotate lanes, 32 bytes per step, splitmix finaliser).
+// Not cryptographic; only used to notice that a file has changed.
+inline uint64_t crystalHash64(const char* data, size_t n, uint64_t seed = 0)
+{
+  const uint64_t k1 = 0x9E3779B185EBCA87ULL, k2 = 0xC2B2AE3D27D4EB4FULL;
+  uint64_t lane[4] = { seed + k1 + k2, seed + k2, seed, seed - k1 };
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    for (int l = 0; l < 4; l++) {
+      uint64_t w;
+      std::memcpy(&w, data + i + 8 * l, 8);
+      lane[l] += w * k2;
+      lane[l] = (lane[l] << 31) | (lane[l] >> 33);
+      lane[l] *= k1;
+    }
+  }
+  uint64_t h = n;
+  for (int l = 0; l < 4; l++) h = (h ^ lane[l]) * k1 + k2;
+  for (; i < n; i++) h = (h ^ (unsigned char)data[i]) * 0x100000001B3ULL;
+  h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 27; h *= 0x94D049BB133111EBULL;
+  h ^= h >> 31;
+  return h;
+}
+
+// Everything that changes how a file is parsed; bump the version when the parser changes
+inline std::string crystalParseSettings()
+{
+  std::string settings = "crystal_csvReader v2; separators ' ' '\\t' ',' '\\r'; status";
+  for (int s = 0; s < kNStatus; s++) settings += std::string(" ") + crystalStatusName(s);
+  return settings;
+}
+
+inline uint64_t crystalCacheKey(const char* data, size_t n)
+{
+  const std::string settings = crystalParseSettings();
+  return crystalHash64(data, n, crystalHash64(settings.data(), settings.size()));
+}
+
+inline std::string crystalCachePath(const std::string& csv, const CrystalCacheConfig& config)
+{
+  if (config.dir.empty()) return csv + ".ltcache";
+  size_t slash = csv.rfind('/');
+  return config.dir + "/" + (slash == std::string::npos ? csv : csv.substr(slash + 1)) + ".ltcache";
+}
+
+
+struct CrystalCacheHeader {
+  char     magic[8];
+  uint32_t bom;
+  uint32_t headerSize;
+  uint64_t key;
+  int32_t  nscanFile;
+  int32_t  nscan;
+  int32_t  nrow;
+  int32_t  ndiag;
+  int64_t  nbad;
+};
+
+static const char     kCrystalCacheMagic[8] = { 'P', 'W', 'O', 'L', 'T', 'C', '0', '2' };
+static const uint32_t kCrystalCacheBOM      = 0x01020304;
+
+
+// Load the sidecar at path if it was written for key. Returns false (spectra untouched) otherwise.
+inline bool crystalLoadCache(const std::string& path, uint64_t key, CrystalCSVInfo& info, CrystalSpectra& spectra)
+{
+  CrystalMappedFile file(path.c_str());
+  if (!file.IsOpen() || file.Size() < sizeof(CrystalCacheHeader)) return false;
+  CrystalCacheHeader h;
+  std::memcpy(&h, file.Begin(), sizeof(h));
+  if (std::memcmp(h.magic, kCrystalCacheMagic, 8) != 0 || h.bom != kCrystalCacheBOM ||
+      h.headerSize != sizeof(h) || h.key != key || h.nscan < 0 || h.nrow < 0 ||
+      h.ndiag < 0 || h.ndiag > CrystalCSVDiagnostics::kMaxStored) return false;
+  const size_t nscan = h.nscan, nrow = h.nrow;
+  const size_t size = sizeof(h) + 2 * nscan * sizeof(int32_t) + (nrow + nscan * nrow) * sizeof(double) +
+                      kNDiagnostic * sizeof(int64_t) + h.ndiag * sizeof(CrystalCSVDiagnostic);
+  if (file.Size() != size) return false;
+
+  const char* p = file.Begin() + sizeof(h);
+  std::vector<int32_t> crystal(nscan), status(nscan);
+  // an empty file has no scans or no rows: memcpy and fwrite must not see the null buffers
+  if (nscan) {
+    std::memcpy(crystal.data(), p, nscan * sizeof(int32_t));
+    std::memcpy(status.data(),  p + nscan * sizeof(int32_t), nscan * sizeof(int32_t));
+  }
+  p += 2 * nscan * sizeof(int32_t);
+  spectra.Resize(nscan, nrow);
+  for (size_t i = 0; i < nscan; i++) spectra.SetScan(i, crystal[i], status[i]);
+  if (nrow) std::memcpy(spectra.WL(), p, nrow * sizeof(double));
+  p += nrow * sizeof(double);
+  if (nscan && nrow) std::memcpy(spectra[0], p, nscan * nrow * sizeof(double));
+  p += nscan * nrow * sizeof(double);
+  int64_t count[kNDiagnostic];
+  std::memcpy(count, p, sizeof(count));                            p += sizeof(count);
+  std::vector<CrystalCSVDiagnostic> diag(h.ndiag);
+  if (h.ndiag > 0) std::memcpy(diag.data(), p, h.ndiag * sizeof(CrystalCSVDiagnostic));
+  info.diagnostics.Set(count, diag.data(), h.ndiag);
+
+  info.nscanFile = h.nscanFile;
+  info.nscan     = h.nscan;
+  info.nrow      = h.nrow;
+  info.nbad      = h.nbad;
+  info.cached    = true;
+  return true;
+}
+
+// Write the sidecar for spectra (read from a file with the given key). The file is written under a
+// temporary name and renamed, so a concurrent reader never sees a partial sidecar.
+inline bool crystalWriteCache(const std::string& path, uint64_t key, const CrystalCSVInfo& info,
+                              const CrystalSpectra& spectra)
+{
+  CrystalCacheHeader h;
+  std::memset(&h, 0, sizeof(h));
+  std::memcpy(h.magic, kCrystalCacheMagic, 8);
+  h.bom        = kCrystalCacheBOM;
+  h.headerSize = sizeof(h);
+  h.key        = key;
+  h.nscanFile  = info.nscanFile;
+  h.nscan      = spectra.NScans();
+  h.nrow       = spectra.NWavelengths();
+  h.nbad       = info.nbad;
+  h.ndiag      = info.diagnostics.NStored();
+
+  const std::string tmp = path + ".tmp" + std::to_string((long)::getpid());
+  FILE* f = std::fopen(tmp.c_str(), "wb");
+  if (!f) return false;
+  std::vector<int32_t> crystal(h.nscan), status(h.nscan);
+  for (int i = 0; i < h.nscan; i++) { crystal[i] = spectra.Crystal(i); status[i] = spectra.Status(i); }
+  bool ok = std::fwrite(&h, sizeof(h), 1, f) == 1;
+  if (h.nscan) {
+    ok = ok && std::fwrite(crystal.data(), sizeof(int32_t), h.nscan, f) == (size_t)h.nscan;
+    ok = ok && std::fwrite(status.data(), sizeof(int32_t), h.nscan, f) == (size_t)h.nscan;
+  }
+  if (h.nrow) ok = ok && std::fwrite(spectra.WL(), sizeof(double), h.nrow, f) == (size_t)h.nrow;
+  if (h.nscan && h.nrow)
+    ok = ok && std::fwrite(spectra[0], sizeof(double), (size_t)h.nscan * h.nrow, f) == (size_t)h.nscan * h.nrow;
+  int64_t count[kNDiagnostic];
+  for (int i = 0; i < kNDiagnostic; i++) count[i] = info.diagnostics.Count(i);
+  ok = ok && std::fwrite(count, sizeof(count), 1, f) == 1;
+  for (int i = 0; ok && i < h.ndiag; i++) ok = std::fwrite(&info.diagnostics.Get(i), sizeof(CrystalCSVDiagnostic), 1, f) == 1;
+  ok = (std::fclose(f) == 0) && ok;
+  if (ok) ok = std::rename(tmp.c_str(), path.c_str()) == 0;
+  if (!ok) std::remove(tmp.c_str());
+  return ok;
+}
+
+
+// Read a Giessen LT file through the cache: load the sidecar if it matches the file contents,
+// otherwise parse the text and (re)write the sidecar. Failing to write the sidecar (e.g. a read-only
+// data directory) is not an error: the first failure sets info.cacheWriteFailed and config.readOnly,
+// which stops the writes of this and of later reads. Returns false only if the csv file cannot be opened.
+inline bool readGiessenCSVCached(const char* path, CrystalCSVInfo& info, CrystalSpectra& spectra,
+                                 const CrystalCacheConfig& config)
+{
+  if (!config.enabled) return readGiessenCSV(path, info, spectra);
+  double t0 = crystalNow();
+  CrystalMappedFile file(path);
+  if (!file.IsOpen()) {
+    info = CrystalCSVInfo();
+    return false;
+  }
+  const uint64_t key = crystalCacheKey(file.Begin(), file.Size());
+  const std::string sidecar = crystalCachePath(path, config);
+  const double topen = crystalNow() - t0;   // the content hash is part of opening a cached file
+  info = CrystalCSVInfo();
+  info.nbytes = file.Size();
+  t0 = crystalNow();
+  if (crystalLoadCache(sidecar, key, info, spectra)) {
+    spectra.SetFileName(path);
+    info.openSeconds = topen;
+    info.bodySeconds = crystalNow() - t0;
+    return true;
+  }
+  parseGiessenCSV(file.Begin(), file.End(), path, info, spectra);
+  if (!config.readOnly && !crystalWriteCache(sidecar, key, info, spectra) && !config.readOnly.exchange(true))
+    info.cacheWriteFailed = true;
+  info.openSeconds = topen;
+  return true;
+}
+
+#endif
@@ -0,0 +1,100 @@
+// crystal_campaign.h - Reads a whole test campaign (several Giessen csv files) into one CrystalSpectra store.
+//
+// File names may be given as shell globs ("GiessenData/BOX*_PROD.csv"). The files are parsed
+// concurrently, one file per worker (crystal_parallel.h), then merged in the order they were listed,
+// so the result does not depend on which worker finished first. Every scan keeps the index of
+// its source file (CrystalSpectra::Source()).
+
+#ifndef CRYSTAL_CAMPAIGN_H
+#define CRYSTAL_CAMPAIGN_H
+
+#include <string>
+#include <vector>
+
+#include <glob.h>
+
+#include "crystal_cache.h"
+#include "crystal_csvReader.h"
+#include "crystal_parallel.h"
+#include "crystal_spectra.h"
+
+
+enum ECampaignFileError {
+  kCampaignFileOk         = 0,
+  kCampaignFileOpenFailed = 1,   // file could not be opened
+  kCampaignFileGrid       = 2    // wavelength grid differs from the first file read, not merged
+};
+
+// Outcome of reading one file of the campaign
+struct CrystalCampaignFile {
+  std::string    name;
+  CrystalCSVInfo info;
+  int            error;   // ECampaignFileError
+};
+
+
+// Expand every pattern with glob(3), keeping the pattern order; within a pattern the matches are sorted.
+// A pattern without matches is kept as is, so that the reader reports it as missing.
+inline std::vector<std::string> crystalExpandFiles(const std::vector<std::string>& patterns)
+{
+  std::vector<std::string> files;
+  for (size_t i = 0; i < patterns.size(); i++) {
+    glob_t g;
+    if (::glob(patterns[i].c_str(), 0, 0, &g) == 0) {
+      for (size_t k = 0; k < g.gl_pathc; k++) files.push_back(g.gl_pathv[k]);
+    }
+    else files.push_back(patterns[i]);
+    ::globfree(&g);
+  }
+  return files;
+}
+
+// Split a whitespace separated list of files/globs, as passed to the macro
+inline std::vector<std::string> crystalSplitList(const std::string& list)
+{
+  std::vector<std::string> words;
+  size_t p = 0;
+  while (p < list.size()) {
+    size_t b = list.find_first_not_of(" \t\n", p);
+    if (b == std::string::npos) break;
+    size_t e = list.find_first_of(" \t\n", b);
+    if (e == std::string::npos) e = list.size();
+    words.push_back(list.substr(b, e - b));
+    p = e;
+  }
+  return words;
+}
+
+
+// Parse files on nthreads workers (0 == one per core) and merge them into spectra; with the cache
+// enabled, unchanged files are loaded from their sidecars (crystal_cache.h).
+// report receives one entry per file, in the order of files. Returns the number of files merged.
+inline int readGiessenCampaign(const std::vector<std::string>& files, int nthreads, CrystalSpectra& spectra,
+                               std::vector<CrystalCampaignFile>& report,
+                               const CrystalCacheConfig& cache = CrystalCacheConfig())
+{
+  const int nfile = files.size();
+  std::vector<CrystalSpectra> parts(nfile);
+  report.assign(nfile, CrystalCampaignFile());
+  crystalParallelFor(nfile, nthreads, [&](int i) {
+    report[i].name  = files[i];
+    report[i].error = readGiessenCSVCached(files[i].c_str(), report[i].info, parts[i], cache) ? kCampaignFileOk
+                                                                                                 : kCampaignFileOpenFailed;
+  });
+
+  int nscan = 0;
+  for (int i = 0; i < nfile; i++) nscan += parts[i].NScans();
+
+  spectra = CrystalSpectra();
+  int nmerged = 0;
+  for (int i = 0; i < nfile; i++) {
+    if (report[i].error != kCampaignFileOk) continue;
+    if (nmerged == 0) spectra.Reserve(nscan, parts[i].NWavelengths());
+    if (!spectra.Append(parts[i])) report[i].error = kCampaignFileGrid;
+    else nmerged++;
+    parts[i] = CrystalSpectra();   // release the per-file copy straight away
+  }
+  return nmerged;
+}
+
+#endif
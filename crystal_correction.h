@@ -0,0 +1,164 @@
+// crystal_correction.h - Baseline and scale correction of LT spectra.
+//
+//   LT_corr(wl) = scale(wl) * 100 * (LT(wl) - baseline(wl)) / (reference(wl) - baseline(wl))
+//
+// baseline  : dark / zero-transmission scan (0 where not given)
+// reference : 100 % scan without crystal; without it the baseline-subtracted LT is not renormalised
+// scale     : per-wavelength scale curve, e.g. a reflection-loss correction (1 where not given)
+//
+// The three curves are interpolated onto the wavelength grid of the store once, and folded into a
+// gain and a bias per wavelength: LT_corr = gain * LT + bias. Apply() is then a single multiply-add
+// over each contiguous row, which the compiler vectorises, run over the scans on the thread pool.
+// Points where a curve does not cover the grid, or reference <= baseline, come out as NaN.
+//
+// Baseline and reference scans are read from Giessen csv files (the first trace of the file is used);
+// scale curves are plain text, one "wl value" pair per line, '#' starts a comment.
+
+#ifndef CRYSTAL_CORRECTION_H
+#define CRYSTAL_CORRECTION_H
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "crystal_csvReader.h"
+#include "crystal_parallel.h"
+#include "crystal_spectra.h"
+#include "crystal_wavelength.h"
+
+
+// A curve value(wl), sampled on its own monotonic grid
+struct CrystalCurve {
+  std::vector<double> wl;
+  std::vector<double> value;
+  std::string         source;
+
+  bool Empty() const { return wl.empty(); }
+
+  // Linear interpolation of the curve at every point of grid; NaN outside the curve. Returns false
+  // if the curve grid is not monotonic.
+  bool Sample(const double* grid, int n, std::vector<double>& out) const
+  {
+    CrystalWavelengthIndex index(wl.data(), wl.size());
+    out.assign(n, std::numeric_limits<double>::quiet_NaN());
+    if (!index.IsValid()) return false;
+    for (int j = 0; j < n; j++) out[j] = index.Interpolate(value.data(), grid[j]);
+    return true;
+  }
+};
+
+// Curve from scan iscan of a store
+inline CrystalCurve crystalCurveFromScan(const CrystalSpectra& spectra, int iscan)
+{
+  CrystalCurve curve;
+  if (iscan < 0 || iscan >= spectra.NScans()) return curve;
+  curve.wl.assign(spectra.WL(), spectra.WL() + spectra.NWavelengths());
+  curve.value.assign(spectra[iscan], spectra[iscan] + spectra.NWavelengths());
+  if (spectra.NFiles() > 0) curve.source = spectra.FileName(spectra.Source(iscan));
+  return curve;
+}
+
+// First scan of a Giessen csv file. Returns false if the file cannot be read or holds no scan.
+inline bool crystalReadScanCurve(const char* path, CrystalCurve& curve)
+{
+  CrystalCSVInfo info;
+  CrystalSpectra spectra;
+  if (!readGiessenCSV(path, info, spectra) || spectra.NScans() == 0 || spectra.NWavelengths() == 0) return false;
+  curve = crystalCurveFromScan(spectra, 0);
+  return true;
+}
+
+// Two-column "wl value" text file. Returns false if the file cannot be opened or has no pair.
+inline bool crystalReadCurve(const char* path, CrystalCurve& curve)
+{
+  CrystalMappedFile file(path);
+  if (!file.IsOpen()) return false;
+  curve = CrystalCurve();
+  curve.source = path;
+  const char* p = file.Begin();
+  const char* end = file.End();
+  while (p != end) {
+    const char* eol = crystalLineEnd(p, end);
+    const char* hash = static_cast<const char*>(std::memchr(p, '#', eol - p));
+    const char* stop = hash ? hash : eol;
+    double x = 0, v = 0;
+    long nbad = 0;
+    int ntoken = parseGiessenRow(p, stop, 1, x, nbad, [&](int, double y) { v = y; });
+    if (ntoken >= 2 && nbad == 0) {
+      curve.wl.push_back(x);
+      curve.value.push_back(v);
+    }
+    p = eol == end ? end : eol + 1;
+  }
+  return !curve.Empty();
+}
+
+
+class CrystalCorrection {
+public:
+  CrystalCorrection() {}
+
+  void SetBaseline(const CrystalCurve& curve)  { fBaseline = curve; }
+  void SetReference(const CrystalCurve& curve) { fReference = curve; }
+  void SetScale(const CrystalCurve& curve)     { fScale = curve; }
+
+  bool IsEnabled() const { return !fBaseline.Empty() || !fReference.Empty() || !fScale.Empty(); }
+
+  // Fold the curves into gain and bias on the grid. Returns false if a curve is not monotonic.
+  bool Build(const double* wl, int nwl)
+  {
+    std::vector<double> baseline(nwl, 0.), reference, scale(nwl, 1.);
+    bool ok = true;
+    if (!fBaseline.Empty())  ok = fBaseline.Sample(wl, nwl, baseline) && ok;
+    if (!fReference.Empty()) ok = fReference.Sample(wl, nwl, reference) && ok;
+    if (!fScale.Empty())     ok = fScale.Sample(wl, nwl, scale) && ok;
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    fGain.resize(nwl);
+    fBias.resize(nwl);
+    fScaleOnGrid = scale;
+    for (int j = 0; j < nwl; j++) {
+      double gain = scale[j];
+      if (!reference.empty()) {
+        const double range = reference[j] - baseline[j];
+        gain = range > 0 ? gain * 100. / range : nan;
+      }
+      fGain[j] = gain;
+      fBias[j] = -gain * baseline[j];
+    }
+    return ok;
+  }
+
+  int           NWavelengths() const { return fGain.size(); }
+  const double* Gain()  const { return fGain.data(); }
+  const double* Bias()  const { return fBias.data(); }
+  const double* Scale() const { return fScaleOnGrid.data(); }
+
+  // corrected = raw with every LT value replaced by gain * LT + bias; Build() must have been called
+  // with the grid of raw. Scans are split over nthreads workers (0 == one per core).
+  void Apply(const CrystalSpectra& raw, CrystalSpectra& corrected, int nthreads = 0) const
+  {
+    corrected = raw;
+    const int nwl = raw.NWavelengths();
+    if (nwl != NWavelengths()) return;
+    const double* __restrict gain = fGain.data();
+    const double* __restrict bias = fBias.data();
+    crystalParallelRanges(raw.NScans(), nthreads, [&](int, int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        double* __restrict lt = corrected[i];
+        for (int j = 0; j < nwl; j++) lt[j] = gain[j] * lt[j] + bias[j];
+      }
+    });
+  }
+
+private:
+  CrystalCurve        fBaseline;
+  CrystalCurve        fReference;
+  CrystalCurve        fScale;
+  std::vector<double> fGain;
+  std::vector<double> fBias;
+  std::vector<double> fScaleOnGrid;
+};
+
+#endif
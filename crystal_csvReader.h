@@ -0,0 +1,466 @@
+// crystal_csvReader.h - Memory-mapped reader for the Giessen LT csv files used by crystal_dataReader.cc.
+//                       The whole file is mapped read-only and the header words and wavelength/LT pairs
+//                       are parsed in place, so no std::string is built per token.
+//
+// File layout (as written by the Giessen spectrometer export):
+//   line 1 : number of traces in the file (NgieFile)
+//   line 2 : one name per trace, "PbWO_NNN_abc", NNN = crystal number, abc = bef/irr/ann
+//   line 3+: one row per wavelength, "wl LT wl LT ..." with one wl/LT pair per trace
+//
+// Tokens may be separated by spaces, tabs or commas; DOS line endings are accepted.
+//
+// Parsing never throws and never stops at a bad line. Problems are recorded as diagnostics with their
+// line and column (1-based; the column is the field number in the line) in CrystalCSVInfo and the
+// parse goes on: a cell that is not a number, or an LT missing from a short row, is stored as NaN;
+// pairs beyond the last named trace are ignored. On clean input the checks are one comparison per row.
+
+#ifndef CRYSTAL_CSVREADER_H
+#define CRYSTAL_CSVREADER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crystal_spectra.h"
+#include "crystal_stages.h"
+
+
+// Read-only view of a complete file. Regular files are mmap'ed; anything that cannot be
+// mapped (pipes, empty files, special files) is read into an owned buffer instead.
+class CrystalMappedFile {
+public:
+  explicit CrystalMappedFile(const char* path) : fData(0), fSize(0), fMap(0)
+  {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+      void* map = ::mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map != MAP_FAILED) {
+        ::madvise(map, st.st_size, MADV_SEQUENTIAL);
+        fMap = map;
+        fData = static_cast<const char*>(map);
+        fSize = st.st_size;
+        ::close(fd);
+        return;
+      }
+    }
+    char chunk[1 << 16];
+    ssize_t n;
+    while ((n = ::read(fd, chunk, sizeof(chunk))) > 0) fBuffer.insert(fBuffer.end(), chunk, chunk + n);
+    ::close(fd);
+    if (n < 0) return;
+    fData = fBuffer.empty() ? "" : &fBuffer[0];
+    fSize = fBuffer.size();
+  }
+
+  ~CrystalMappedFile()
+  {
+    if (fMap) ::munmap(fMap, fSize);
+  }
+
+  bool        IsOpen() const { return fData != 0; }
+  const char* Begin()  const { return fData; }
+  const char* End()    const { return fData + fSize; }
+  size_t      Size()   const { return fSize; }
+
+private:
+  CrystalMappedFile(const CrystalMappedFile&);
+  CrystalMappedFile& operator=(const CrystalMappedFile&);
+
+  const char*       fData;
+  size_t            fSize;
+  void*             fMap;
+  std::vector<char> fBuffer;
+};
+
+
+inline bool crystalIsSeparator(char c) { return c == ' ' || c == '\t' || c == ',' || c == '\r'; }
+inline bool crystalIsDigit(char c)     { return (unsigned char)(c - '0') < 10; }
+
+
+// Parse the number in [p, end). Returns false if the token is not entirely a number.
+// Plain decimals with up to 19 significant digits and a small exponent are converted exactly
+// (mantissa and power of ten are both representable, so one multiply/divide rounds correctly);
+// everything else goes through strtod on a stack copy of the token.
+inline bool crystalParseDouble(const char* p, const char* end, double& value)
+{
+  static const double kPow10[] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+  const char* start = p;
+  bool negative = false;
+  if (p != end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+
+  uint64_t mantissa = 0;
+  int      ndigits  = 0;   // significant digits accumulated in mantissa
+  int      exp10    = 0;
+  bool     any      = false;
+  for (; p != end && crystalIsDigit(*p); p++) {
+    any = true;
+    if (ndigits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) ndigits++; }
+    else exp10++;
+  }
+  if (p != end && *p == '.') {
+    for (p++; p != end && crystalIsDigit(*p); p++) {
+      any = true;
+      if (ndigits < 19) { mantissa = mantissa * 10 + (*p - '0'); if (mantissa) ndigits++; exp10--; }
+    }
+  }
+  if (any && p != end && (*p == 'e' || *p == 'E')) {
+    const char* q = p + 1;
+    bool eneg = false;
+    if (q != end && (*q == '-' || *q == '+')) eneg = (*q++ == '-');
+    if (q != end && crystalIsDigit(*q)) {
+      int e = 0;
+      for (; q != end && crystalIsDigit(*q); q++) if (e < 10000) e = e * 10 + (*q - '0');
+      exp10 += eneg ? -e : e;
+      p = q;
+    }
+  }
+
+  if (any && p == end && mantissa < (uint64_t(1) << 53) && exp10 >= -22 && exp10 <= 22) {
+    double v = double(mantissa);
+    v = exp10 < 0 ? v / kPow10[-exp10] : v * kPow10[exp10];
+    value = negative ? -v : v;
+    return true;
+  }
+
+  // slow path: long mantissas, large exponents, inf/nan
+  char buf[64];
+  size_t len = end - start;
+  if (len == 0 || len >= sizeof(buf)) return false;
+  std::memcpy(buf, start, len);
+  buf[len] = 0;
+  char* stop;
+  value = std::strtod(buf, &stop);
+  return stop == buf + len;
+}
+
+inline bool crystalParseInt(const char* p, const char* end, int& value)
+{
+  bool negative = false;
+  if (p != end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+  if (p == end) return false;
+  int v = 0;
+  for (; p != end; p++) {
+    if (!crystalIsDigit(*p)) return false;
+    const int d = *p - '0';
+    if (v > (std::numeric_limits<int>::max() - d) / 10) return false;   // before it can overflow
+    v = v * 10 + d;
+  }
+  value = negative ? -v : v;
+  return true;
+}
+
+
+enum ECrystalDiagnostic {
+  kDiagBadCount      = 0,   // line 1 is not an integer trace count
+  kDiagCountMismatch = 1,   // line 1 count differs from the number of trace names on line 2
+  kDiagBadName       = 2,   // trace name without a crystal number or a known status
+  kDiagBadCell       = 3,   // cell that is not a number, stored as NaN
+  kDiagShortRow      = 4,   // row with fewer values than 2 x traces, missing LT stored as NaN
+  kDiagLongRow       = 5,   // row with values beyond the last named trace, ignored
+  kNDiagnostic       = 6
+};
+
+struct CrystalCSVDiagnostic {
+  int32_t code;       // ECrystalDiagnostic
+  int32_t line;
+  int32_t column;
+  int32_t expected;   // count expected and found, for the count and row-length diagnostics
+  int32_t found;
+};
+
+// Diagnostics of one file: counts per code, and the first kMaxStored in full
+class CrystalCSVDiagnostics {
+public:
+  static const int kMaxStored = 64;
+
+  CrystalCSVDiagnostics() { Clear(); }
+
+  void Clear()
+  {
+    for (int i = 0; i < kNDiagnostic; i++) fCount[i] = 0;
+    fList.clear();
+  }
+
+  void Add(int code, int line, int column, int expected = 0, int found = 0)
+  {
+    fCount[code]++;
+    if (fList.size() < (size_t)kMaxStored) {
+      CrystalCSVDiagnostic d = { code, line, column, expected, found };
+      fList.push_back(d);
+    }
+  }
+
+  long Count(int code) const { return fCount[code]; }
+  long Total() const
+  {
+    long n = 0;
+    for (int i = 0; i < kNDiagnostic; i++) n += fCount[i];
+    return n;
+  }
+  int NStored() const { return fList.size(); }
+  const CrystalCSVDiagnostic& Get(int i) const { return fList[i]; }
+
+  // Restore from a sidecar (crystal_cache.h)
+  void Set(const int64_t* count, const CrystalCSVDiagnostic* list, int nstored)
+  {
+    for (int i = 0; i < kNDiagnostic; i++) fCount[i] = count[i];
+    fList.assign(list, list + nstored);
+  }
+
+private:
+  long                              fCount[kNDiagnostic];
+  std::vector<CrystalCSVDiagnostic> fList;
+};
+
+// "line L, column C: <problem>"
+inline std::string crystalFormatDiagnostic(const CrystalCSVDiagnostic& d)
+{
+  char buf[160];
+  int n = std::snprintf(buf, sizeof(buf), "line %d, column %d: ", d.line, d.column);
+  const size_t room = sizeof(buf) - n;
+  switch (d.code) {
+  case kDiagBadCount:      std::snprintf(buf + n, room, "trace count is not an integer"); break;
+  case kDiagCountMismatch: std::snprintf(buf + n, room, "%d trace names, line 1 declares %d", d.found, d.expected); break;
+  case kDiagBadName:       std::snprintf(buf + n, room, "trace name without crystal number or status"); break;
+  case kDiagBadCell:       std::snprintf(buf + n, room, "not a number, stored as NaN"); break;
+  case kDiagShortRow:      std::snprintf(buf + n, room, "%d values, %d expected; missing LT stored as NaN", d.found, d.expected); break;
+  case kDiagLongRow:       std::snprintf(buf + n, room, "%d values, %d expected; values from here on ignored", d.found, d.expected); break;
+  default:                 std::snprintf(buf + n, room, "diagnostic %d", d.code); break;
+  }
+  return buf;
+}
+
+inline const char* crystalDiagnosticName(int code)
+{
+  static const char* names[kNDiagnostic] = { "bad trace count", "count mismatch", "bad trace name", "bad cell", "short row", "long row" };
+  return code >= 0 && code < kNDiagnostic ? names[code] : "?";
+}
+
+
+// Summary of one parsed file
+struct CrystalCSVInfo {
+  int    nscanFile;   // trace count on the first line of the file
+  int    nscan;       // trace names found in the header (scans stored)
+  int    nrow;        // wavelength rows read (wavelengths stored)
+  long   nbad;        // cells that were not numbers (stored as NaN)
+  size_t nbytes;      // size of the file
+  bool   cached;      // loaded from the binary sidecar instead of parsed (crystal_cache.h)
+  bool   cacheWriteFailed; // its sidecar could not be written, the first such file of the run
+  double openSeconds;     // wall time to open/map the file
+  double headerSeconds;   // ... to parse the count line and trace names
+  double bodySeconds;     // ... to parse the LT values (or load them from the sidecar)
+  CrystalCSVDiagnostics diagnostics;   // problems found, with line and column
+
+  CrystalCSVInfo()
+    : nscanFile(0), nscan(0), nrow(0), nbad(0), nbytes(0), cached(false), cacheWriteFailed(false), openSeconds(0), headerSeconds(0), bodySeconds(0) {}
+};
+
+
+// ECrystalStatus for the trailing part of a trace name ("bef", "irr", ...), kStatusUnknown otherwise
+inline int crystalStatusCode(const char* p, const char* end)
+{
+  size_t n = end - p;
+  for (int status = 0; status < kNStatus; status++) {
+    const char* name = crystalStatusName(status);
+    if (std::strlen(name) == n && std::memcmp(p, name, n) == 0) return status;
+  }
+  return kStatusUnknown;
+}
+
+// Split a trace name "PbWO_NNN_abc" on '_' : field 1 is the crystal number, field 2 the status.
+inline void crystalParseTraceName(const char* p, const char* end, int& crynum, int& status)
+{
+  crynum = -1;
+  status = -1;
+  int nfield = 0;
+  while (p != end) {
+    while (p != end && *p == '_') p++;
+    const char* q = p;
+    while (q != end && *q != '_') q++;
+    if (q == p) break;
+    if (nfield == 1 && !crystalParseInt(p, q, crynum)) crynum = -1;
+    if (nfield == 2) status = crystalStatusCode(p, q);
+    nfield++;
+    p = q;
+  }
+}
+
+// End of the line starting at p (position of '\n', or end)
+inline const char* crystalLineEnd(const char* p, const char* end)
+{
+  const char* nl = static_cast<const char*>(std::memchr(p, '\n', end - p));
+  return nl ? nl : end;
+}
+
+
+// Number of lines in [p, end), counting a last line without '\n'
+inline int crystalCountLines(const char* p, const char* end)
+{
+  int n = 0;
+  while (p != end) {
+    p = crystalLineEnd(p, end);
+    n++;
+    if (p != end) p++;
+  }
+  return n;
+}
+
+
+// Parse the count line and the trace names at the start of a Giessen LT file.
+// names receives (crystal number, status) per trace; returns the start of the first data row.
+inline const char* parseGiessenHeader(const char* begin, const char* end, CrystalCSVInfo& info,
+                                      std::vector<std::pair<int, int> >& names)
+{
+  const char* p = begin;
+
+  // line 1: trace count
+  const char* eol = crystalLineEnd(p, end);
+  const char* q = p;
+  while (q != eol && crystalIsSeparator(*q)) q++;
+  const char* t = q;
+  while (t != eol && !crystalIsSeparator(*t)) t++;
+  if (!crystalParseInt(q, t, info.nscanFile) || info.nscanFile < 0) {
+    info.nscanFile = 0;
+    info.diagnostics.Add(kDiagBadCount, 1, 1);
+  }
+  p = eol == end ? end : eol + 1;
+
+  // line 2: trace names
+  names.clear();
+  names.reserve(info.nscanFile > 0 ? info.nscanFile : 0);
+  eol = crystalLineEnd(p, end);
+  while (p != eol) {
+    while (p != eol && crystalIsSeparator(*p)) p++;
+    if (p == eol) break;
+    const char* w = p;
+    while (p != eol && !crystalIsSeparator(*p)) p++;
+    int crynum, status;
+    crystalParseTraceName(w, p, crynum, status);
+    if (crynum < 0 || status < 0) info.diagnostics.Add(kDiagBadName, 2, names.size() + 1);
+    names.push_back(std::make_pair(crynum, status));
+  }
+  info.nscan = names.size();
+  if (info.nscan != info.nscanFile)
+    info.diagnostics.Add(kDiagCountMismatch, 2, std::min(info.nscan, info.nscanFile) + 1, info.nscanFile, info.nscan);
+  return eol == end ? end : eol + 1;
+}
+
+// Parse one data row "wl LT wl LT ..." in [p, eol): token 0 goes to wl, the LT of trace iscan < nscan
+// to lt(iscan, value). Cells that are not numbers are passed on as NaN, counted in nbad and, with
+// diag, recorded at the given line. Returns the number of tokens, 0 for a blank line.
+template <class LTSink>
+inline int parseGiessenRow(const char* p, const char* eol, int nscan, double& wl, long& nbad, LTSink lt,
+                           CrystalCSVDiagnostics* diag = 0, int line = 0)
+{
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  int ntoken = 0;
+  while (p != eol) {
+    while (p != eol && crystalIsSeparator(*p)) p++;
+    if (p == eol) break;
+    const char* w = p;
+    while (p != eol && !crystalIsSeparator(*p)) p++;
+    double v;
+    if (!crystalParseDouble(w, p, v)) {
+      v = nan;
+      nbad++;
+      if (diag) diag->Add(kDiagBadCell, line, ntoken + 1);
+    }
+    if (ntoken & 1) {
+      int iscan = ntoken >> 1;
+      if (iscan < nscan) lt(iscan, v);
+    }
+    else if (ntoken == 0) wl = v;
+    ntoken++;
+  }
+  return ntoken;
+}
+
+// Length check of a row of ntoken values parsed by parseGiessenRow: the traces the row has no LT for
+// are set to NaN through lt and the row is recorded as short; values beyond the last trace make it long.
+template <class LTSink>
+inline void crystalCheckRow(int ntoken, int nscan, int line, CrystalCSVDiagnostics& diag, LTSink lt)
+{
+  if (ntoken == 2 * nscan || ntoken == 0) return;
+  if (ntoken > 2 * nscan) {
+    diag.Add(kDiagLongRow, line, 2 * nscan + 1, 2 * nscan, ntoken);
+    return;
+  }
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  for (int iscan = ntoken >> 1; iscan < nscan; iscan++) lt(iscan, nan);
+  diag.Add(kDiagShortRow, line, ntoken + 1, 2 * nscan, ntoken);
+}
+
+// Parse the data rows [p, end), starting at line firstLine of the file, into spectra, which must
+// already hold info.nscan scans and at least as many wavelengths as there are rows; it is trimmed to
+// the rows actually read.
+inline void parseGiessenBody(const char* p, const char* end, CrystalCSVInfo& info, CrystalSpectra& spectra,
+                             int firstLine = 3)
+{
+  double* wl = spectra.WL();
+
+  for (int line = firstLine; p != end; line++) {
+    const char* eol = crystalLineEnd(p, end);
+    const int row = info.nrow;
+    double* lt = spectra[0] + row;
+    const size_t stride = spectra.NWavelengths();
+    auto sink = [=](int iscan, double v) { lt[iscan * stride] = v; };
+    int ntoken = parseGiessenRow(p, eol, info.nscan, wl[row], info.nbad, sink, &info.diagnostics, line);
+    crystalCheckRow(ntoken, info.nscan, line, info.diagnostics, sink);
+    if (ntoken > 0) info.nrow++;   // blank lines (e.g. at end of file) are not rows
+    p = eol == end ? end : eol + 1;
+  }
+  spectra.ShrinkWavelengths(info.nrow);
+}
+
+// Parse the contents [begin, end) of a Giessen LT file, named path, into spectra, which is resized to
+// (trace names in the header) x (data rows). Pairs beyond the last named trace are ignored.
+inline void parseGiessenCSV(const char* begin, const char* end, const char* path, CrystalCSVInfo& info,
+                            CrystalSpectra& spectra)
+{
+  info = CrystalCSVInfo();
+  info.nbytes = end - begin;
+  double t0 = crystalNow();
+  std::vector<std::pair<int, int> > names;
+  const char* body = parseGiessenHeader(begin, end, info, names);
+  info.headerSeconds = crystalNow() - t0;
+  t0 = crystalNow();
+
+  // every remaining line is at most one row; trailing blank lines are trimmed afterwards
+  spectra.Resize(info.nscan, crystalCountLines(body, end));
+  spectra.SetFileName(path);
+  for (int i = 0; i < info.nscan; i++) spectra.SetScan(i, names[i].first, names[i].second);
+  parseGiessenBody(body, end, info, spectra);
+  info.bodySeconds = crystalNow() - t0;
+}
+
+// Read a Giessen LT file into spectra. Returns false only if the file cannot be opened.
+inline bool readGiessenCSV(const char* path, CrystalCSVInfo& info, CrystalSpectra& spectra)
+{
+  const double t0 = crystalNow();
+  CrystalMappedFile file(path);
+  if (!file.IsOpen()) {
+    info = CrystalCSVInfo();
+    return false;
+  }
+  const double topen = crystalNow() - t0;
+  parseGiessenCSV(file.Begin(), file.End(), path, info, spectra);
+  info.openSeconds = topen;
+  return true;
+}
+
+#endif
@@ -11,6 +11,9 @@
 // csv file must contain the number of contained traces on the first line, and the name of the
 // trace must have the form "PbWO-***-abc", where '***' is an  integer, and 'abc' is a trailing string indicating other information
 // (these specifics of the csv file may vary)
+//
+// Run as a macro (root -l 'crystal_dataReader.cc("file.csv")'), or build the compiled batch reader with
+// "make" and run ./crystal_dataReader --help for the command line options.
 
 
 #include <TH1.h>
@@ -18,6 +21,7 @@
 #include <TH3.h>
 #include <TStyle.h>
 #include <TCanvas.h>
+#include <TColor.h>
 #include <TRandom.h>
 #include <stdio.h>
 #include <TGraph.h>
@@ -25,27 +29,83 @@
 #include <fstream>
 #include <sstream>
 #include <stdlib.h>
-#include <boost/tokenizer.hpp>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
 
 
 //#include "TCrystal.h"
-#define Ncrystals 400
+#include "crystal_spectra.h"
+#include "crystal_csvReader.h"
+#include "crystal_campaign.h"
+#include "crystal_treeWriter.h"
+#include "crystal_treeReader.h"
+#include "crystal_pairing.h"
+#include "crystal_deltaK.h"
+#include "crystal_wavelength.h"
+#include "crystal_plots.h"
+#include "crystal_stream.h"
+#include "crystal_log.h"
+#include "crystal_stages.h"
+#include "crystal_quality.h"
+#include "crystal_qualityWriter.h"
+#include "crystal_correction.h"
+#include "crystal_history.h"
+#include "crystal_pairsWriter.h"
+#include "crystal_fit.h"
+#include "crystal_fitWriter.h"
+#include "crystal_manifest.h"
+
 #define Nrad       25
 #define Nann       17
 #define Ntest     100
 #define Nbroken    25
-#define Ngie      400
-#define Ngiewl   1151
 #define maxScans 50
 
 using namespace std;
-using namespace boost;
 
 
-void crystal_dataReader()
+// Run configuration, filled from the macro arguments or from the command line of the compiled reader
+struct CrystalReaderOptions {
+  vector<string>    inputs;     // Giessen csv files or globs, read in parallel and merged (crystal_campaign.h)
+  CrystalTreeConfig tree;       // output file, compression and basket size (crystal_treeWriter.h)
+  double            length;     // crystal length (m) used for deltaK
+  int               nThreads;   // worker threads for reading, 0 == one per core
+  CrystalCacheConfig cache;     // binary sidecars "<file>.ltcache", next to the csv or in cache.dir (crystal_cache.h)
+  size_t            streamMemory; // > 0: bounded-memory streaming mode with this budget in bytes (crystal_stream.h)
+  bool              plots;      // render the per-crystal plots
+  CrystalPlotConfig plot;       // plot file(s) and worker processes (crystal_plots.h)
+  string            baselineFile;   // calibration for the corrected spectra, empty for none (crystal_correction.h):
+  string            referenceFile;  //   Giessen csv files whose first scan is the baseline / 100 % reference,
+  string            scaleFile;      //   and a "wl scale" text file
+  string            historyFile;    // multi-campaign history the scans are appended to, empty for none (crystal_history.h)
+  string            campaign;       // campaign name in the history, default the name of the first input file
+  int               historyCrystal; // >= 0: print the history of this crystal
+  bool              fit;        // fit the deltaK spectra with absorption bands (crystal_fit.h)
+  CrystalFitConfig  fitConfig;  // seed bands and fit range
+  CrystalQualityConfig quality; // acceptance cuts of the quality summary (crystal_quality.h)
+  int               logLevel;   // ECrystalLogLevel: quiet, info or debug (crystal_log.h)
+  string            statsFile;  // per-stage timing summary as JSON, "-" for stdout, empty for none (crystal_stages.h)
+  bool              incremental; // only read the scans not yet in the output, per "<output>.manifest" (crystal_manifest.h)
+  double            watchSeconds; // > 0: repeat the incremental run at this interval until killed
+
+  CrystalReaderOptions() : length(0.2), nThreads(0), cache(true), streamMemory(0), plots(false), historyCrystal(-1), fit(false), logLevel(kLogInfo),
+                           incremental(false), watchSeconds(0) {}
+};
+
+// Exit codes of runCrystalDataReader() and of the compiled reader
+enum ECrystalReaderExit {
+  kReaderOk          = 0,
+  kReaderNoInput     = 1,   // none of the input files could be read
+  kReaderUsage       = 2,   // bad command line
+  kReaderOutputError = 3,   // output file could not be written
+  kReaderCalibration = 4    // a calibration file could not be read
+};
+
+
+void setCrystalStyle()
 {
-
-
     gStyle->SetCanvasBorderMode(0);
     gStyle->SetCanvasColor(10);
 
@@ -79,457 +139,774 @@ void crystal_dataReader()
     Int_t FI = TColor::CreateGradientColorTable(6, stop, re, gr, bl, colNum);
     for (int i = 0; i < colNum; i++) MyPalette[i] = FI + i;
     gStyle->SetPalette(colNum, MyPalette);
+}
+
+
+// Print the stage table, write the JSON summary if asked for and flush the log; returns code
+int finishCrystalDataReader(const CrystalReaderOptions& opt, const CrystalStageTimer& stages, int code)
+{
+    CRYSTAL_LOG(kLogInfo) << "Stages:\n" << stages.Format();
+    crystalLogger().Flush();
+    if (!opt.statsFile.empty() && !stages.WriteJSON(opt.statsFile)) {
+      CRYSTAL_LOG(kLogQuiet) << "Warning: stage summary could not be written to " << opt.statsFile;
+      crystalLogger().Flush();
+    }
+    return code;
+}
+
+
+// Print every scan of opt.historyCrystal in the history file: campaign, status, file and LT at 360/420/620 nm
+int printCrystalHistory(const CrystalReaderOptions& opt, CrystalHistoryDB& history)
+{
+    vector<CrystalHistoryScan> scans;
+    history.History(opt.historyCrystal, scans);
+    CRYSTAL_LOG(kLogQuiet) << "Crystal " << opt.historyCrystal << " : " << scans.size() << " scans in "
+                           << history.NCampaigns() << " campaign(s) of " << opt.historyFile;
+    CrystalHistoryCampaign campaign;
+    campaign.id = -1;
+    for (size_t i = 0; i < scans.size(); i++) {
+      if (scans[i].campaign != campaign.id && !history.GetCampaign(scans[i].campaign, campaign)) continue;
+      CrystalWavelengthIndex index(campaign.wl.data(), campaign.wl.size());
+      CRYSTAL_LOG(kLogQuiet) << "  " << campaign.name << " " << crystalStatusName(scans[i].status) << " scan " << scans[i].scan
+                             << " (" << scans[i].file << ") LT360 " << index.Interpolate(scans[i].lt.data(), 360)
+                             << " LT420 " << index.Interpolate(scans[i].lt.data(), 420)
+                             << " LT620 " << index.Interpolate(scans[i].lt.data(), 620);
+    }
+    return scans.size();
+}
+
+
+// Parse problems of one file (crystal_csvReader.h): a count per kind as a warning, the first few with
+// their line and column at info level, the rest of those kept at debug level
+void logCrystalDiagnostics(const string& name, const CrystalCSVInfo& info)
+{
+    const CrystalCSVDiagnostics& diag = info.diagnostics;
+    if (diag.Total() == 0) return;
+    {
+      CrystalLogLine line(kLogQuiet);
+      line << "Warning: " << name << " : " << diag.Total() << " problem(s)";
+      const char* sep = " (";
+      for (int code = 0; code < kNDiagnostic; code++) {
+        if (diag.Count(code) == 0) continue;
+        line << sep << diag.Count(code) << " " << crystalDiagnosticName(code);
+        sep = ", ";
+      }
+      line << ")";
+    }
+    for (int i = 0; i < diag.NStored(); i++)
+      CRYSTAL_LOG(i < 5 ? kLogInfo : kLogDebug) << "  " << name << ", " << crystalFormatDiagnostic(diag.Get(i));
+}
+
+
+// Settings an incremental run must share with the run that wrote the output: the LT leaf type and the
+// calibration files (lt_corr exists only with a correction). The contents of the calibration files are
+// not compared.
+string crystalIncrementalSettings(const CrystalReaderOptions& opt)
+{
+    return "lt/" + opt.tree.LeafType() + " baseline=" + opt.baselineFile + " reference=" + opt.referenceFile + " scale=" + opt.scaleFile;
+}
+
+struct CrystalIncrementalRead {
+    bool append;     // spectra starts with the scans of the existing output, the tree is appended to
+    bool upToDate;   // no file changed since the manifest was written, spectra is empty
+    int  nold;       // scans already in the output
+};
+
+// Incremental mode (crystal_manifest.h): files whose size and mtime match the manifest are not opened;
+// the others are read (in parallel, through the cache) and only their scans beyond those already
+// ingested are kept. spectra receives the scans of the existing output followed by the new ones, and
+// the manifest is updated for the files read. If the output cannot be appended to (no manifest, other
+// settings, or a tree that does not match the manifest) every file is read and the output is recreated.
+CrystalIncrementalRead readCrystalIncremental(const CrystalReaderOptions& opt, const vector<string>& files, CrystalManifest& manifest,
+                                              CrystalSpectra& spectra, vector<CrystalCampaignFile>& report, CrystalStageTimer& stages)
+{
+    CrystalIncrementalRead result = { false, false, 0 };
+    const string settings = crystalIncrementalSettings(opt);
+    const bool haveManifest = manifest.Load(crystalManifestPath(opt.tree.fileName));
+    if (haveManifest && manifest.Settings() == settings) result.append = true;
+    else {
+      if (haveManifest) CRYSTAL_LOG(kLogQuiet) << "Output settings changed since " << crystalManifestPath(opt.tree.fileName) << ", rebuilding " << opt.tree.fileName;
+      manifest.Clear();
+      manifest.SetSettings(settings);
+    }
+
+    vector<string> changed;
+    vector<CrystalManifestEntry> changedStat;
+    for (size_t i = 0; i < files.size(); i++) {
+      CrystalManifestEntry e;
+      e.file = files[i];
+      const CrystalManifestEntry* old = manifest.Find(files[i]);
+      if (crystalFileStat(files[i], e.size, e.mtime) && old && old->size == e.size && old->mtime == e.mtime) continue;
+      changed.push_back(files[i]);
+      changedStat.push_back(e);
+    }
+    if (result.append && changed.empty()) {
+      result.upToDate = true;
+      return result;
+    }
+
+    if (result.append) {
+      const double t0 = crystalNow();
+      long ningested = 0;
+      for (int i = 0; i < manifest.NFiles(); i++) ningested += manifest.GetEntry(i).nscan;
+      if (!readCrystalTree(opt.tree.fileName, spectra) || spectra.NScans() != ningested) {
+        CRYSTAL_LOG(kLogQuiet) << opt.tree.fileName << " does not match " << crystalManifestPath(opt.tree.fileName) << ", rebuilding it";
+        result.append = false;
+        spectra = CrystalSpectra();
+        manifest.Clear();
+        manifest.SetSettings(settings);
+        changed = files;
+        changedStat.assign(files.size(), CrystalManifestEntry());
+        for (size_t i = 0; i < files.size(); i++) {
+          changedStat[i].file = files[i];
+          crystalFileStat(files[i], changedStat[i].size, changedStat[i].mtime);
+        }
+      }
+      else {
+        stages.Add(kStageBody, crystalNow() - t0, spectra.Bytes(), (double)spectra.NScans() * spectra.NWavelengths());
+        result.nold = spectra.NScans();
+        CRYSTAL_LOG(kLogInfo) << "Loaded " << result.nold << " scans already in " << opt.tree.fileName << ", "
+                              << changed.size() << " of " << files.size() << " file(s) changed";
+      }
+    }
 
-    int    mystatus[Ncrystals][18] = { 0 };
-    string myname[18] = { "AF","BF3","BF4","CF","AR","BR3","BR4","CR","L1","L2","L3","L4","LY","LT360","LT420","LT620","TTO","ALL" };
-    float  myvalue[Ncrystals][18] = { 0 };
-    float  mysigma[Ncrystals][18] = { 0 };
-    int    mynumber[18] = { 0 };
-    int    mytest[Ncrystals] = { 0 };
-    int    mybroken[Ncrystals] = { 0 };
+    CrystalSpectra parsed;
+    readGiessenCampaign(changed, opt.nThreads, parsed, report, opt.cache);
+    if (parsed.NScans() == 0) return result;
+    if (result.append && !spectra.SameGrid(parsed)) {
+      CRYSTAL_LOG(kLogQuiet) << "Warning: the new files are on a different wavelength grid from " << opt.tree.fileName << ", not appended";
+      return result;
+    }
+
+    // the scans of each file are contiguous in parsed; keep those beyond the ingested ones
+    vector<string> names = spectra.FileNames();
+    spectra.Reserve(spectra.NScans() + parsed.NScans(), parsed.NWavelengths());
+    for (int i = 0, n = 0; i < parsed.NScans(); i += n) {
+      const int src = parsed.Source(i);
+      for (n = 1; i + n < parsed.NScans() && parsed.Source(i + n) == src; n++) {}
+      const string& file = parsed.FileName(src);
+      const CrystalManifestEntry* old = manifest.Find(file);
+      const int nold = old ? old->nscan : 0;
+      if (nold > n || (nold > 0 && crystalManifestScanKey(parsed, i, nold) != old->key)) {
+        CRYSTAL_LOG(kLogQuiet) << "Warning: scans of " << file << " were removed or renamed since they were ingested, "
+                               << "none appended; rerun without --incremental to rebuild " << opt.tree.fileName;
+        continue;
+      }
+      int ifile = 0;
+      while (ifile < (int)names.size() && names[ifile] != file) ifile++;
+      if (ifile == (int)names.size()) names.push_back(file);
+      for (int k = nold; k < n; k++) spectra.AppendScan(parsed, i + k, ifile);
+
+      CrystalManifestEntry e;
+      for (size_t j = 0; j < changed.size(); j++)
+        if (changed[j] == file) e = changedStat[j];
+      e.file  = file;
+      e.nscan = n;
+      e.key   = crystalManifestScanKey(parsed, i, n);
+      manifest.Set(e);
+    }
+    spectra.SetFileNames(names);
+    return result;
+}
 
 
-    // Create histos
+// Streaming mode: the files are read one at a time with bounded memory and every scan is written to the
+// tree as soon as its column block is complete. The spectra are never all in memory, so pairing, deltaK
+// and plots are left to the analysis of the tree.
+int streamCrystalDataReader(const CrystalReaderOptions& opt, CrystalStageTimer& gieStages)
+{
+    if (opt.plots) CRYSTAL_LOG(kLogInfo) << "Streaming mode: no plots, run the analysis on " << opt.tree.fileName;
+    vector<string> gieFiles = crystalExpandFiles(opt.inputs);
+    CrystalStreamReader gieStream(CrystalStreamConfig(opt.streamMemory));
+    CrystalTreeWriter* treeWriter = 0;
+    vector<double> treeWL;
+    CrystalHistoryDB gieHistory;
+    if (!opt.historyFile.empty() && !gieHistory.Open(opt.historyFile)) {
+      CRYSTAL_LOG(kLogQuiet) << "History file failed to open: " << opt.historyFile;
+      return finishCrystalDataReader(opt, gieStages, kReaderOutputError);
+    }
+    int NgieRead = 0;
+    for (size_t ifile = 0; ifile < gieFiles.size(); ifile++) {
+      const double t0 = crystalNow();
+      if (!gieStream.Open(gieFiles[ifile].c_str())) {
+        CRYSTAL_LOG(kLogQuiet) << "File failed to open: " << gieFiles[ifile];
+        continue;
+      }
+      const CrystalCSVInfo& info = gieStream.Info();
+      gieStages.Add(kStageBody, crystalNow() - t0, info.nbytes, (double)info.nscan * info.nrow);
+      if (!treeWriter) {
+        treeWL.assign(gieStream.WL(), gieStream.WL() + gieStream.NWavelengths());
+        treeWriter = new CrystalTreeWriter(opt.tree, gieStream.WL(), gieStream.NWavelengths(), gieFiles);
+        if (!treeWriter->IsOpen()) {
+          CRYSTAL_LOG(kLogQuiet) << "Output file failed to open: " << opt.tree.fileName;
+          delete treeWriter;
+          return finishCrystalDataReader(opt, gieStages, kReaderOutputError);
+        }
+        gieHistory.BeginCampaign(opt.campaign.empty() ? crystalPlotTag(gieFiles[ifile]) : opt.campaign, gieStream.WL(),
+                                 gieStream.NWavelengths(), gieFiles);
+      }
+      bool sameGrid = (int)treeWL.size() == gieStream.NWavelengths();
+      for (int i = 0; sameGrid && i < gieStream.NWavelengths(); i++) sameGrid = fabs(treeWL[i] - gieStream.WL()[i]) <= 1e-3;
+      {
+        CrystalLogLine line(sameGrid ? kLogInfo : kLogQuiet);
+        line << "Read " << info.nscan << " scans x " << info.nrow << " wavelengths from " << gieFiles[ifile];
+        if (gieStream.Spilled()) line << " (" << gieStream.SpillBytes() / (1 << 20) << " MB spilled)";
+        if (info.nbad > 0) line << " (" << info.nbad << " unreadable cells)";
+        if (!sameGrid) line << " - different wavelength grid, skipped";
+      }
+      logCrystalDiagnostics(gieFiles[ifile], info);
+      if (!sameGrid) continue;
+
+      CrystalStageScope write(gieStages, kStageWrite);
+      bool ok = gieStream.ForEachBlock([&](int /*first*/, const CrystalSpectra& block) {
+        for (int i = 0; i < block.NScans(); i++) treeWriter->Fill(block.Crystal(i), block.Status(i), block[i], ifile);
+        gieHistory.AddScans(block, ifile);
+      });
+      write.SetItems(info.nscan);
+      if (!ok) CRYSTAL_LOG(kLogQuiet) << "Warning: spill file read failed, " << gieFiles[ifile] << " incomplete";
+      NgieRead++;
+    }
+    if (!treeWriter) {
+      CRYSTAL_LOG(kLogQuiet) << "No input file could be read";
+      return finishCrystalDataReader(opt, gieStages, kReaderNoInput);
+    }
+    {
+      CrystalStageScope write(gieStages, kStageWrite);
+      treeWriter->Close();
+      write.SetBytes(treeWriter->BytesWritten());
+      if (gieHistory.IsOpen()) gieHistory.EndCampaign();
+    }
+    CRYSTAL_LOG(kLogInfo) << "Wrote " << treeWriter->GetEntries() << " scans from " << NgieRead << " file(s) to " << opt.tree.fileName;
+    if (gieHistory.IsOpen()) {
+      CRYSTAL_LOG(kLogInfo) << "History " << opt.historyFile << " : " << gieHistory.NScans() << " scans in " << gieHistory.NCampaigns() << " campaigns";
+      if (opt.historyCrystal >= 0) printCrystalHistory(opt, gieHistory);
+    }
+    delete treeWriter;
+    return finishCrystalDataReader(opt, gieStages, kReaderOk);
+}
+
+
+int runCrystalDataReader(const CrystalReaderOptions& opt)
+{
+    crystalLogger().SetLevel(opt.logLevel);
+    CrystalStageTimer gieStages;
+    if (opt.inputs.empty() && opt.historyCrystal >= 0) {
+      // history lookup only
+      CrystalHistoryDB gieHistory;
+      if (!gieHistory.Open(opt.historyFile)) {
+        CRYSTAL_LOG(kLogQuiet) << "History file failed to open: " << opt.historyFile;
+        return finishCrystalDataReader(opt, gieStages, kReaderNoInput);
+      }
+      printCrystalHistory(opt, gieHistory);
+      return finishCrystalDataReader(opt, gieStages, kReaderOk);
+    }
+    if (opt.streamMemory > 0) return streamCrystalDataReader(opt, gieStages);
+    if (opt.plots) setCrystalStyle();
 
     //exctracting results of Giessen test
-    
-    double gieID[Ngie] = { 0 };
-    int gieSTAT[Ncrystals] = { 0 };
-    double gieWL[Ngiewl];
-    double giescale[Ngiewl];
-    double gieratio[Ngiewl];
-    double deltaK[Ngie];
-    double gie_LTO[Ngie][Ngiewl] = { 0 };
-    double gie_LTO_corr[Ngie][Ngiewl] = { 0 };
-    double gie_LTO_ID[Ncrystals] = { 0 };
-    double gie_LTO_stat[Ncrystals] = { 0 };
-    double gie_LTO360_pre[Ncrystals] = { 0 };
-    double gie_LTO360_post[Ncrystals] = { 0 };
-    double gie_LTO360_acc[Ncrystals] = { 0 };
-    double gie_LTO420_pre[Ncrystals] = { 0 };
-    double gie_LTO420_post[Ncrystals] = { 0 };
-    double gie_LTO420_acc[Ncrystals] = { 0 };
-    double gie_LTO620_pre[Ncrystals] = { 0 };
-    double gie_LTO620_post[Ncrystals] = { 0 };
-    double gie_LTO620_acc[Ncrystals] = { 0 };
-    double gie_DK[Ncrystals];
-    double sic_DK[Ncrystals];
-    double y[9][1151] = { 0 };
-    double length = 0.2;
-    FILE* gieFile;
-    int  NgieFile = 0;
-
-
-    cout << "\nReading Giessen data" << endl;
-    //   for(int ifile=6; ifile<7; ifile++) {
-    //     if(ifile==0) gieFile = fopen ("/home/stuart/FT/Crystals/Archive2/GiessenData/BOX1_2_3_4_PROD.csv","r");
-    //     if(ifile==1) gieFile = fopen ("/home/stuart/FT/Crystals/Archive2/GiessenData/BOX5_6_PROD.csv","r");
-    //     if(ifile==2) gieFile = fopen ("/home/stuart/FT/Crystals/Archive2/GiessenData/BOX7_PROD.csv","r");
-    //     if(ifile==3) gieFile = fopen ("/home/stuart/FT/Crystals/Archive2/GiessenData/BOX7_149_irr_PROD_2.csv","r");
-    //     if(ifile==4) gieFile = fopen ("/home/stuart/FT/Crystals/Archive2/GiessenData/BOX8_PROD.csv","r");
-    //     if(ifile==5) gieFile = fopen ("/home/stuart/FT/Crystals/Archive2/GiessenData/BOX9_10_PROD.csv","r");
-    //     //gieFile = fopen ("/home/stuart/FT/Data/Crystal_337.csv","r");
-    //     //if(ifile==6) gieFile = fopen ("/home/stuart/FT/Crystals/Archive2/GiessenData/Box11_16-5__PROD.csv","r");
-    //     if(ifile==6)
-
-      //gieFile = fopen ("/home/stuart/FT/Crystals/Archive2/GiessenData/Crystal_020.csv","r");
-      //gieFile = fopen ("/home/stuart/FT/Crystals/Archive2/GiessenData/Crystal_023.csv","r");
-      //gieFile = fopen ("/home/stuart/FTGiessenData/Crystal023.csv","r");
-      //gieFile = fopen ("/home/stuart/FTGiessenData/Crystal020_023.csv","r");
-      //gieFile = fopen ("/home/stuart/FT/GiessenIII/BOX_BTCP_PROD.csv","r");
-    
-    //gieFile = fopen("BOX7_PROD.csv", "r");
-    //ifstream file("Box11-tuesday_PROD_truncated.csv", std::ifstream::in);
-    ifstream file("/home/stuart/SideProjects/PWO/LT_Data/BOX1_2_3_4_PROD.csv", std::ifstream::in);
-    
-    //ifstream file3("BOX5_6_PROD.csv", std::ifstream::in);
-    //ifstream file4("BOX8_PROD.csv", std::ifstream::in);
-    //ifstream file5("BOX9_10_PROD.csv", std::ifstream::in);
-    //file.open("BOX7_PROD.csv");
-    //if (file.is_open()) {
-        //cout << "File failed to open." << endl;
-      //  return 1;
-    //}
-    int current_line = 0;
-    string line;
-    string word;
-    istringstream iss;
-    int nscan = 0;
-    int nscan2 = 0;
-    int crynum;
-    int odd = 1;
-    int counter = 0;
-    int count = 0;
-    int status;
-    int crystal[161][161] = { 0 };
-
-    //Crystal status (bef, irr, etc)
-    std::pair <int, int> crystalInfo;
-    vector < std::pair<int, int>> crystalData;
-
-//     //Crystal LT
-//     std::pair <double, double> LTVal;//wavelength, light transmission pairs
-//     vector < std::pair<double, double>> crystalLT;
-        
-
-    while (!file.eof()) {
-        
-      //int counter = 0;
-      current_line++;
-      std::getline(file, line);
-      //cout << line << endl;
-      if (current_line == 1) {
-	NgieFile = std::stoi(line);
-	//cout << NgieFile << endl;
-        
+
+    CrystalDeltaK deltaK;   // deltaK and LT ratio spectra, one row per bef/irr pair (replaces gie_DK/sic_DK)
+    // LT spectra, wavelength grid, crystal number and status (gieSTAT) of every scan in the file, on the heap
+    // and sized from the file (crystal_spectra.h); gie_LTO[iscan][iwl] as before
+    CrystalSpectra gie_LTO;
+    const double length = opt.length;
+
+
+    CRYSTAL_LOG(kLogInfo) << "\nReading Giessen data";
+
+    // Each file is memory mapped and parsed in place (see crystal_csvReader.h); data rows start at
+    // gieWL[0] / gie_LTO[i][0], the count and header lines are not stored as rows.
+    vector<string> gieFiles = crystalExpandFiles(opt.inputs);
+    vector<CrystalCampaignFile> gieReport;
+    CrystalManifest gieManifest;   // incremental runs: files and scans already in the output
+    CrystalIncrementalRead gieIncremental = { false, false, 0 };
+    if (gieFiles.size() == 1 && crystalPlotIsRoot(gieFiles[0])) {
+      // archived campaign: the crystals tree of an earlier run, decoded straight into the store (crystal_treeReader.h)
+      if (gieFiles[0] == opt.tree.fileName) {
+        CRYSTAL_LOG(kLogQuiet) << "Input and output are the same file: " << gieFiles[0];
+        return finishCrystalDataReader(opt, gieStages, kReaderUsage);
+      }
+      const double tread = crystalNow();
+      if (!readCrystalTree(gieFiles[0], gie_LTO)) {
+        CRYSTAL_LOG(kLogQuiet) << "No crystals tree could be read from " << gieFiles[0];
+        return finishCrystalDataReader(opt, gieStages, kReaderNoInput);
       }
-      //if(file.is_open()) {
-      //cout << "File failed to open." << endl;
-      //  return 1;
-      //}
-      if (current_line == 2) {
-	iss.str(line);
-	while (iss.good()) {
-	  iss >> word;
-	  //cout << word <<endl;
-	  nscan++;
-	  char_separator<char> sep("_");
-	  tokenizer<char_separator<char>> tokens(word, sep);
-	  int Nword = 0;
-	  for (const string& s : tokens) {
-	    //cout << s << Nword << endl;
-	    if (Nword == 1) {
-	      crynum = std::stoi(s);
-	      //cout << crynum << endl;
-		cout << s << endl;
-              
-	    }
-	    if (Nword == 2) {
-	      //cout << s << endl;
-	      if (s.compare("bef") == 0) {
-		gieSTAT[nscan] = 0;
-		cout << "bef" << endl;
-		//gieSTAT[nscan] = status;
-	      }
-	      else if (s.compare("irr") == 0) {
-		gieSTAT[nscan] = 1;
-		cout << "irr" << endl;
-		//gieSTAT[nscan] = status;
-	      }
-	    }
-	    else {
-	      //cout << "no thanks" << endl;
-	    }
-	    //cout << gieSTAT[nscan] << endl;
-
-	    Nword++;
-	  }
-          
-	  crystalInfo = make_pair(crynum, gieSTAT[nscan]);
-	  crystalData.push_back(crystalInfo);
-	  //cout << crystalData.at(count).first << " " << crystalData.at(count).second << endl;
-	  count++;
-	}
+      gieStages.Add(kStageBody, crystalNow() - tread, gie_LTO.Bytes(), (double)gie_LTO.NScans() * gie_LTO.NWavelengths());
+      CRYSTAL_LOG(kLogInfo) << "Read " << gie_LTO.NScans() << " scans x " << gie_LTO.NWavelengths() << " wavelengths from " << gieFiles[0];
+    }
+    else if (opt.incremental) {
+      gieIncremental = readCrystalIncremental(opt, gieFiles, gieManifest, gie_LTO, gieReport, gieStages);
+      if (gieIncremental.upToDate) {
+        CRYSTAL_LOG(kLogInfo) << "No file changed since the last run, " << opt.tree.fileName << " is up to date";
+        return finishCrystalDataReader(opt, gieStages, kReaderOk);
+      }
+      if (gie_LTO.NScans() == 0) {
+        CRYSTAL_LOG(kLogQuiet) << "No input file could be read";
+        return finishCrystalDataReader(opt, gieStages, kReaderNoInput);
       }
-      //cout << crystalData.size() << endl;
-      //cout << crystalData.at(1).first << endl;
-      
-      else {   
-	odd = 1;
-	//cout << odd << endl;
-	char_separator<char> sep(" ");
-	tokenizer<char_separator<char>> tokens(line, sep);
-	
-	for (const string& s : tokens) {
-	  double gie_lto, gie_wl;
-	  if (odd % 2 == 0) {
-	    gie_lto = std::stod(s);
-	    gie_LTO[(odd / 2) - 1][counter] = gie_lto;
-	    // cout << odd << endl;
-	  }
-	  else {
-	    gie_wl = std::stod(s);
-	    gieWL[counter] = gie_wl;
-	    //cout << odd << endl;
-	  }
-	  odd++;
-	  
-	}
-	//cout << gie_LTO[(odd / 2) - 1][counter] << " " << gieWL[counter] << endl;
-	
-	counter++;
+    }
+    else if (readGiessenCampaign(gieFiles, opt.nThreads, gie_LTO, gieReport, opt.cache) == 0) {
+      CRYSTAL_LOG(kLogQuiet) << "No input file could be read";
+      return finishCrystalDataReader(opt, gieStages, kReaderNoInput);
+    }
+    for (size_t ifile = 0; ifile < gieReport.size(); ifile++) {
+      const CrystalCampaignFile& rf = gieReport[ifile];
+      if (rf.error == kCampaignFileOpenFailed) { CRYSTAL_LOG(kLogQuiet) << "File failed to open: " << rf.name; continue; }
+      gieStages.Add(kStageOpen, rf.info.openSeconds, rf.info.nbytes, 1);
+      gieStages.Add(kStageHeader, rf.info.headerSeconds, 0, rf.info.nscan);
+      gieStages.Add(kStageBody, rf.info.bodySeconds, rf.info.nbytes, (double)rf.info.nscan * rf.info.nrow);
+      {
+        CrystalLogLine line(rf.error == kCampaignFileGrid ? kLogQuiet : kLogInfo);
+        line << "Read " << rf.info.nscan << " scans x " << rf.info.nrow << " wavelengths from " << rf.name;
+        if (rf.info.cached) line << " (cached)";
+        if (rf.info.nbad > 0) line << " (" << rf.info.nbad << " unreadable cells)";
+        if (rf.error == kCampaignFileGrid) line << " - different wavelength grid, skipped";
       }
+      logCrystalDiagnostics(rf.name, rf.info);   // includes a trace count that differs from the header names
+      if (rf.info.cacheWriteFailed)
+        CRYSTAL_LOG(kLogQuiet) << "Warning: cannot write the cache sidecar " << crystalCachePath(rf.name, opt.cache)
+                               << ", no further sidecars are written (see --cache-dir, --no-cache)";
+    }
+    const int Nscan = gie_LTO.NScans();
+    const int Nwl = gie_LTO.NWavelengths();
+    double* gieWL = gie_LTO.WL();
+    if (Nwl == 0) {   // header lines only: nothing to pair, analyse or plot
+      CRYSTAL_LOG(kLogQuiet) << "No wavelength rows in the input";
+      return finishCrystalDataReader(opt, gieStages, kReaderNoInput);
+    }
+    if (gie_LTO.NFiles() > 1) CRYSTAL_LOG(kLogInfo) << "Merged " << Nscan << " scans from " << gie_LTO.NFiles() << " files";
+    const int NgieOld = gieIncremental.nold;   // scans already in the output tree
+    if (gieIncremental.append && Nscan == NgieOld) {
+      if (!gieManifest.Save(crystalManifestPath(opt.tree.fileName)))
+        CRYSTAL_LOG(kLogQuiet) << "Warning: manifest could not be written: " << crystalManifestPath(opt.tree.fileName);
+      CRYSTAL_LOG(kLogInfo) << "No new scans, " << opt.tree.fileName << " is up to date";
+      return finishCrystalDataReader(opt, gieStages, kReaderOk);
     }
 
+    // baseline / reference / scale correction, folded into a gain and bias per wavelength and applied
+    // to all scans in one pass (crystal_correction.h). The corrected spectra are kept next to the raw
+    // ones and everything downstream (deltaK, bands, quality, plots) uses them.
+    CrystalCorrection gieCorrection;
+    CrystalCurve gieCurve;
+    if (!opt.baselineFile.empty()) {
+      if (!crystalReadScanCurve(opt.baselineFile.c_str(), gieCurve)) {
+        CRYSTAL_LOG(kLogQuiet) << "Baseline file could not be read: " << opt.baselineFile;
+        return finishCrystalDataReader(opt, gieStages, kReaderCalibration);
+      }
+      gieCorrection.SetBaseline(gieCurve);
+    }
+    if (!opt.referenceFile.empty()) {
+      if (!crystalReadScanCurve(opt.referenceFile.c_str(), gieCurve)) {
+        CRYSTAL_LOG(kLogQuiet) << "Reference file could not be read: " << opt.referenceFile;
+        return finishCrystalDataReader(opt, gieStages, kReaderCalibration);
+      }
+      gieCorrection.SetReference(gieCurve);
+    }
+    if (!opt.scaleFile.empty()) {
+      if (!crystalReadCurve(opt.scaleFile.c_str(), gieCurve)) {
+        CRYSTAL_LOG(kLogQuiet) << "Scale file could not be read: " << opt.scaleFile;
+        return finishCrystalDataReader(opt, gieStages, kReaderCalibration);
+      }
+      gieCorrection.SetScale(gieCurve);
+    }
+    CrystalSpectra gie_LTO_corr;
+    const bool gieCorrected = gieCorrection.IsEnabled();
+    if (gieCorrected) {
+      double t0 = crystalNow();
+      if (!gieCorrection.Build(gieWL, Nwl)) CRYSTAL_LOG(kLogQuiet) << "Warning: a calibration curve is not monotonic in wavelength";
+      gieCorrection.Apply(gie_LTO, gie_LTO_corr, opt.nThreads);
+      gieStages.Add(kStageCompute, crystalNow() - t0, 2. * Nscan * Nwl * sizeof(double), (double)Nscan * Nwl);
+      CRYSTAL_LOG(kLogInfo) << "Corrected " << Nscan << " scans (baseline " << (opt.baselineFile.empty() ? "-" : opt.baselineFile)
+                            << ", reference " << (opt.referenceFile.empty() ? "-" : opt.referenceFile)
+                            << ", scale " << (opt.scaleFile.empty() ? "-" : opt.scaleFile) << ")";
+    }
+    const CrystalSpectra& gieLT = gieCorrected ? gie_LTO_corr : gie_LTO;   // spectra used by the analysis
 
-     for (int ii = 0; ii < NgieFile; ii++){
 
-//     //Crystal LT
-//     std::pair <double, double> LTVal;//wavelength, light transmission pairs
-//     vector < std::pair<double, double>> crystalLT;
+    double t0 = crystalNow();
+    CrystalTreeConfig gieTreeConfig = opt.tree;
+    gieTreeConfig.corrected = gieCorrected;
+    gieTreeConfig.append = gieIncremental.append;
+    CrystalTreeWriter treeWriter(gieTreeConfig, gieWL, Nwl, gie_LTO.FileNames());
+    if (!treeWriter.IsOpen()) {
+      CRYSTAL_LOG(kLogQuiet) << "Output file failed to open: " << opt.tree.fileName;
+      return finishCrystalDataReader(opt, gieStages, kReaderOutputError);
+    }
 
-       cout << "Crystal number " << crystalData.at(ii).first << " , scan (0 == bef, 1 == irr) = " << crystalData.at(ii).second << endl;
+     for (int ii = NgieOld; ii < Nscan; ii++){
 
-//       for (int jj = 0; jj < 1151; jj++){
-// 	LTVal = make_pair(gieWL[jj],gie_LTO[ii][jj]);
-// 	crystalLT.push_back(LTVal);
-//       }
+       CRYSTAL_LOG(kLogDebug) << "Crystal number " << gie_LTO.Crystal(ii) << " , scan = " << crystalStatusName(gie_LTO.Status(ii));
 
-//       //crystalLT, and all other pertinent values, should then be written to the tree
+       //crystal number, status and spectrum of each scan are written as one entry of the tree
+       treeWriter.Fill(gie_LTO.Crystal(ii), gie_LTO.Status(ii), gie_LTO[ii], gie_LTO.Source(ii), gieCorrected ? gie_LTO_corr[ii] : 0);
 
      }
+    if (gieCorrected) treeWriter.WriteCorrection(gieCorrection.Gain(), gieCorrection.Bias(), Nwl);
+    const Long64_t NgieWritten = treeWriter.GetEntries();
+    treeWriter.Close();
+    gieStages.Add(kStageWrite, crystalNow() - t0, treeWriter.BytesWritten(), NgieWritten - NgieOld);
+    // the manifest follows the tree, so a run interrupted before this point is redone in full next time
+    if (opt.incremental && !gieManifest.Save(crystalManifestPath(opt.tree.fileName)))
+      CRYSTAL_LOG(kLogQuiet) << "Warning: manifest could not be written: " << crystalManifestPath(opt.tree.fileName);
+    {
+      CrystalLogLine line(kLogInfo);
+      if (gieIncremental.append) line << "Appended " << Nscan - NgieOld << " new scans to " << opt.tree.fileName << " (" << NgieWritten << " in total)";
+      else line << "Wrote " << NgieWritten << " scans to " << opt.tree.fileName;
+      if (opt.tree.storage == kStorageFloat) line << " (LT as float, relative error <= " << opt.tree.StorageError() << ")";
+      if (opt.tree.storage == kStorageFixed)
+        line << " (LT as " << opt.tree.fixedBits << "-bit fixed point on [" << opt.tree.fixedMin << ", " << opt.tree.fixedMax
+             << "] %, error <= " << opt.tree.StorageError() << " %)";
+    }
 
-    for (int first = 0; first < NgieFile; first++){
-      for (int j = 1; j < NgieFile; j++) {
-	if (crystalData.at(first).first == crystalData.at(j).first) {
-	  
-	  // cout << crystalData.at(first).first << crystalData.at(first).second << crystalData.at(j).first << crystalData.at(j).second << endl;
-	}
+    // the raw scans of this run become one campaign of the history (crystal_history.h); an incremental
+    // run adds its new scans only
+    if (!opt.historyFile.empty()) {
+      t0 = crystalNow();
+      CrystalHistoryDB gieHistory;
+      if (!gieHistory.Open(opt.historyFile)) {
+        CRYSTAL_LOG(kLogQuiet) << "History file failed to open: " << opt.historyFile;
+        return finishCrystalDataReader(opt, gieStages, kReaderOutputError);
       }
-      
+      const string gieCampaign = opt.campaign.empty() ? crystalPlotTag(gie_LTO.FileName(0)) : opt.campaign;
+      CrystalSpectra gieNew;
+      for (int ii = NgieOld; NgieOld > 0 && ii < Nscan; ii++) gieNew.AppendScan(gie_LTO, ii, gie_LTO.Source(ii));
+      gieNew.SetFileNames(gie_LTO.FileNames());
+      const int id = gieHistory.Append(gieCampaign, NgieOld > 0 ? gieNew : gie_LTO);
+      CRYSTAL_LOG(kLogInfo) << "Added " << Nscan - NgieOld << " scans to " << opt.historyFile << " as campaign " << id << " (" << gieCampaign
+                            << "), " << gieHistory.NScans() << " scans in " << gieHistory.NCampaigns() << " campaigns";
+      if (opt.historyCrystal >= 0) printCrystalHistory(opt, gieHistory);
+      gieHistory.Close();
+      gieStages.Add(kStageWrite, crystalNow() - t0, 0, Nscan - NgieOld);
     }
 
-                
-                
-            
-    
-            
-        
-    
- 
-//     //int crystal[9] = { 145, 146, 136, 138, 139, 151, 162, 160, 156 };
-//     //TGraph *deltas;
-//     for (int iwl = 0; iwl < Ngiewl; iwl++) {//for every wavelength
-        
-        
-//      y[0][iwl] = ((1 / length) * log(gie_LTO[0][iwl] / gie_LTO[9][iwl])); // compute delta k
-//      y[1][iwl] = ((1 / length) * log(gie_LTO[1][iwl] / gie_LTO[10][iwl])); // compute delta k
-//      y[2][iwl] = ((1 / length) * log(gie_LTO[2][iwl] / gie_LTO[11][iwl])); // compute delta k   
-//      y[3][iwl] = ((1 / length) * log(gie_LTO[3][iwl] / gie_LTO[16][iwl])); // compute delta k
-//      y[4][iwl] = ((1 / length) * log(gie_LTO[4][iwl] / gie_LTO[17][iwl])); // compute delta k    
-//      y[5][iwl] = ((1 / length) * log(gie_LTO[5][iwl] / gie_LTO[14][iwl])); // compute delta k
-//      y[6][iwl] = ((1 / length) * log(gie_LTO[6][iwl] / gie_LTO[12][iwl])); // compute delta k
-//      y[7][iwl] = ((1 / length) * log(gie_LTO[7][iwl] / gie_LTO[13][iwl])); // compute delta k
-//      y[8][iwl] = ((1 / length) * log(gie_LTO[8][iwl] / gie_LTO[15][iwl])); // compute delta k
-    
-    
-//     }
-    
-    
-//     TGraph* deltas[9];
-//     for (int i = 0; i < 9; i++) {
-//         deltas[i] = new TGraph(Ngiewl, gieWL, y[i]);
-//         deltas[i]->GetXaxis()->SetTitle("Wavelength (nm)");
-//         deltas[i]->GetYaxis()->SetTitle("DeltaK");
-//         deltas[i]->SetTitle(Form("Crystal_%d", crystal[i]));
-//         deltas[i]->GetYaxis()->SetRangeUser(-0.2, 1.5);
-
-
-            
-            
-
-
-//     }
-//     TCanvas* c90 = new TCanvas("c90", "Crystal 145 dk", 750, 1000);
-    
-//     deltas[0]->Draw("AP*");
-//     c90->Print("crystal145dk.root");
-//     TCanvas* c11a = new TCanvas("c11a", "Crystal 146 dk", 750, 1000);
-//     deltas[1]->Draw("AP*");
-//     c11a->Print("crystal146dk.pdf");
-//     TCanvas* c11b = new TCanvas("c11b", "Crystal 136 dk", 750, 1000);
-//     deltas[2]->Draw("AP*");
-//     c11b->Print("crystal136dk.pdf");
-//     TCanvas* c11c = new TCanvas("c11c", "Crystal 138 dk", 750, 1000);
-//     deltas[3]->Draw("AP*");
-//     c11c->Print("crystal138dk.pdf");
-//     TCanvas* c11d = new TCanvas("c11d", "Crystal 139 dk", 750, 1000);
-//     deltas[4]->Draw("AP*");
-//     c11d->Print("crystal139dk.pdf");
-//     TCanvas* c11e = new TCanvas("c11e", "Crystal 151 dk", 750, 1000);
-//     deltas[5]->Draw("AP*");
-//     c11e->Print("crystal151dk.pdf");
-//     TCanvas* c11f = new TCanvas("c11", "Crystal 162 dk", 750, 1000);
-//     deltas[6]->Draw("AP*");
-//     c11f->Print("crystal162dk.pdf");
-//     TCanvas* c11g = new TCanvas("c11g", "Crystal 160 dk", 750, 1000);
-//     deltas[7]->Draw("AP*");
-//     c11g->Print("crystal160dk.pdf");
-//     TCanvas* c11h = new TCanvas("c11h", "Crystal 156 dk", 750, 1000);
-//     deltas[8]->Draw("AP*");
-//     c11h->Print("crystal156dk.pdf");
-    
-//     //deltakiwl[l] = new TGraph(Ngiewl, gieWL, delak[iwl]);
-
-//     // compute delta k  
-
-
-
-  
-//   cout << "deltaK for 145 at 360 = " << ((1/length) * log (gie_LTO[0][1080]/gie_LTO[9][1080])) << endl; // compute delta k
-//   cout << "deltaK for 146 at 360 = " << ((1 / length) * log(gie_LTO[1][1080] / gie_LTO[10][1080])) << endl; // compute delta k
-//   cout << "deltaK for 136 at 360 = " << ((1 / length) * log(gie_LTO[2][1080] / gie_LTO[11][1080])) << endl; // compute delta k
-//   cout << "deltaK for 138 at 360 = " << ((1 / length) * log(gie_LTO[3][1080] / gie_LTO[16][1080])) << endl; // compute delta k
-//   cout << "deltaK for 139 at 360 = " << ((1 / length) * log(gie_LTO[4][1080] / gie_LTO[17][1080])) << endl; // compute delta k
-//   cout << "deltaK for 151 at 360 = " << ((1 / length) * log(gie_LTO[5][1080] / gie_LTO[14][1080])) << endl; // compute delta k
-//   cout << "deltaK for 162 at 360 = " << ((1 / length) * log(gie_LTO[6][1080] / gie_LTO[12][1080])) << endl; // compute delta k
-//   cout << "deltaK for 160 at 360 = " << ((1 / length) * log(gie_LTO[7][1080] / gie_LTO[13][1080])) << endl; // compute delta k
-//   cout << "deltaK for 156 at 360 = " << ((1 / length) * log(gie_LTO[8][1080] / gie_LTO[15][1080])) << endl; // compute delta k
-  
-
-  
-//   cout << "deltaK for 145 at 420 = " << ((1/length) * log (gie_LTO[0][960]/gie_LTO[9][960])) << endl; // compute delta k
-//   cout << "deltaK for 146 at 420 = " << ((1 / length) * log(gie_LTO[1][960] / gie_LTO[10][960])) << endl; // compute delta k
-//   cout << "deltaK for 136 at 420= " << ((1 / length) * log(gie_LTO[2][960] / gie_LTO[11][960])) << endl; // compute delta k
-//   cout << "deltaK for 138 at 420= " << ((1 / length) * log(gie_LTO[3][960] / gie_LTO[16][960])) << endl; // compute delta k
-//   cout << "deltaK for 139 at 420= " << ((1 / length) * log(gie_LTO[4][960] / gie_LTO[17][960])) << endl; // compute delta k
-//   cout << "deltaK for 151 at 420= " << ((1 / length) * log(gie_LTO[5][960] / gie_LTO[14][960])) << endl; // compute delta k
-//   cout << "deltaK for 162 at 420= " << ((1 / length) * log(gie_LTO[6][960] / gie_LTO[12][960])) << endl; // compute delta k
-//   cout << "deltaK for 160 at 420= " << ((1 / length) * log(gie_LTO[7][960] / gie_LTO[13][960])) << endl; // compute delta k
-//   cout << "deltaK for 156 at 420= " << ((1 / length) * log(gie_LTO[8][960] / gie_LTO[15][960])) << endl; // compute delta k
-
-//   cout << "deltaK for 145 at 620 = " << ((1 / length) * log(gie_LTO[0][560] / gie_LTO[9][560])) << endl; // compute delta k
-//   cout << "deltaK for 146 at 620 = " << ((1 / length) * log(gie_LTO[1][560] / gie_LTO[10][560])) << endl; // compute delta k
-//   cout << "deltaK for 136 at 620 = " << ((1 / length) * log(gie_LTO[2][560] / gie_LTO[11][560])) << endl; // compute delta k
-//   cout << "deltaK for 138 at 620 = " << ((1 / length) * log(gie_LTO[3][560] / gie_LTO[16][560])) << endl; // compute delta k
-//   cout << "deltaK for 139 at 620 = " << ((1 / length) * log(gie_LTO[4][560] / gie_LTO[17][560])) << endl; // compute delta k
-//   cout << "deltaK for 151 at 620 = " << ((1 / length) * log(gie_LTO[5][560] / gie_LTO[14][560])) << endl; // compute delta k
-//   cout << "deltaK for 162 at 620 = " << ((1 / length) * log(gie_LTO[6][560] / gie_LTO[12][560])) << endl; // compute delta k
-//   cout << "deltaK for 160 at 620 = " << ((1 / length) * log(gie_LTO[7][560] / gie_LTO[13][560])) << endl; // compute delta k
-//   cout << "deltaK for 156 at 620 = " << ((1 / length) * log(gie_LTO[8][560] / gie_LTO[15][560])) << endl; // compute delta k
-
-//   cout << "light transmission ratio at 420 for crystal 145 irr " << gie_LTO[9][960] / gie_LTO[0][960] << endl;
-//   cout << "light transmission ratio at 420 for crystal 146 irr " << gie_LTO[10][960] / gie_LTO[1][960] << endl;
-//   cout << "light transmission ratio at 420 for crystal 136 irr " << gie_LTO[11][960] / gie_LTO[2][960] << endl;
-//   cout << "light transmission ratio at 420 for crystal 138 irr " << gie_LTO[16][960] / gie_LTO[3][960] << endl;
-//   cout << "light transmission ratio at 420 for crystal 139 irr " << gie_LTO[17][960] / gie_LTO[4][960] << endl;
-//   cout << "light transmission ratio at 420 for crystal 151 irr " << gie_LTO[14][960] / gie_LTO[5][960] << endl;
-//   cout << "light transmission ratio at 420 for crystal 162 irr " << gie_LTO[12][960] / gie_LTO[6][960] << endl;
-//   cout << "light transmission ratio at 420 for crystal 160 irr " << gie_LTO[13][960] / gie_LTO[7][960] << endl;
-//   cout << "light transmission ratio at 420 for crystal 156 irr " << gie_LTO[15][960] / gie_LTO[8][960] << endl;
-  
-//   //wavelength[3] = {}
-  
-//   cout << "light transmission at 420 for crystal 156 irr " << gie_LTO[8][960] << endl;
-  
-  
-//   //create canvasses
-//   //TCanvas *canvasArray[Ncrystals];
-//   TGraph *gr_LTO_bef[Ncrystals];
-//   TGraph *gr_LTO_corr[Ncrystals];
-//   TGraph *gr_LTO_irr[Ncrystals];
-//   //TGraph *gr_LTO_ratio[Ncrystals];
-//   //TGraph *gr_LTO_scale[Ncrystals];
-//   //TGraph *gr_LTO_baseline[Ncrystals];
-  
-  
-//   //cout << "Giessen Stat " << gieSTAT[cryNum][0] << endl;
-  
-//   for (int i = 0; i < Ncrystals; i++) {
+    // group the scans by crystal number and status, and pair bef/irr scans of the same crystal
+    t0 = crystalNow();
+    CrystalPairing giePairing(gie_LTO);
+    vector<CrystalPair> giePairs = giePairing.Pairs(kStatusBef, kStatusIrr);
+    gieStages.Add(kStagePairing, crystalNow() - t0, 0, Nscan);
+    {
+      CrystalLogLine line(kLogInfo);
+      line << giePairing.NCrystals() << " crystals, " << giePairs.size() << " with bef and irr scans";
+      if (giePairing.NDuplicates() > 0) line << ", " << giePairing.NDuplicates() << " repeated scans ignored";
+      if (giePairing.NUnknown() > 0) line << ", " << giePairing.NUnknown() << " scans with unknown crystal/status";
+    }
+    for (size_t ip = 0; ip < giePairs.size(); ip++)
+      CRYSTAL_LOG(kLogDebug) << "Crystal " << giePairs[ip].crystal << " : bef scan " << giePairs[ip].before << " , irr scan " << giePairs[ip].after;
+
  
-//       gr_LTO_bef[i] = new TGraph(Ngiewl, gieWL, gie_LTO[i]);
-      
-//   }
-//       for (int j = 0; j < 9; j++) {
-
-          
-//           //gr_LTO_bef[j]->SetTitle(Form("Crystal_%d", crystal[j]));
-
-
-//           //gr_LTO_bef[i]->SetTitle(Form("Crystal_%i",i));
-//           //gr_LTO_bef[i]->SetMarkerColor(i);
-//           gr_LTO_bef[j]->GetXaxis()->SetTitle("Wavelength (nm)");
-//           gr_LTO_bef[j]->GetYaxis()->SetTitle("LT (%)");
-
-
-//       }
-
-     
-         
-//   //Histograms
-  
-//   //   //     //c11->Divide(1,2); //divide the canvas into areas
-//   //c11->cd(1);
-  
-//   gr_LTO_bef[0]->SetMarkerColor(1); //black
-//   gr_LTO_bef[1]->SetMarkerColor(1); //red
-//   gr_LTO_bef[2]->SetMarkerColor(1); //green
-//   gr_LTO_bef[3]->SetMarkerColor(1); //blue
-//   gr_LTO_bef[4]->SetMarkerColor(1); //yellow
-//   gr_LTO_bef[5]->SetMarkerColor(1);
-//   gr_LTO_bef[6]->SetMarkerColor(1); //black
-//   gr_LTO_bef[7]->SetMarkerColor(1); //red
-//   gr_LTO_bef[8]->SetMarkerColor(1); //green
-//   gr_LTO_bef[9]->SetMarkerColor(2); //blue
-//   gr_LTO_bef[10]->SetMarkerColor(2); //yellow
-//   gr_LTO_bef[11]->SetMarkerColor(2);
-//   gr_LTO_bef[12]->SetMarkerColor(2); //red
-//   gr_LTO_bef[13]->SetMarkerColor(2); //green
-//   gr_LTO_bef[14]->SetMarkerColor(2); //blue
-//   gr_LTO_bef[15]->SetMarkerColor(2); //yellow
-//   gr_LTO_bef[16]->SetMarkerColor(2);
-//   gr_LTO_bef[17]->SetMarkerColor(2); //red
-  
-
-//   //gr_LTO_bef[24]->SetMarkerColor(1); //black
-//   //gr_LTO_bef[25]->SetMarkerColor(2); //red
-//   //gr_LTO_bef[26]->SetMarkerColor(3); //green
-
-//   //gr_LTO_bef[27]->SetMarkerColor(5); //yellow
-//   //gr_LTO_bef[28]->SetMarkerColor(6); //pink
-
-
-  
-
-
-//   TCanvas* c12 = new TCanvas("c12", "Crystal 145", 750, 1000);  //create canvas
-
-//   gr_LTO_bef[0]->Draw("AP*");
-//   gr_LTO_bef[9]->Draw("PSAME*");
-//   c12->Print("crystal145.pdf");
-//   TCanvas* c12a = new TCanvas("c12a", "Crystal 146", 750, 1000);  //create canvas
-
-//   gr_LTO_bef[1]->Draw("AP*");
-//   gr_LTO_bef[10]->Draw("PSAME*");
-//   c12a->Print("crystal146.pdf");
-//   TCanvas* c12b = new TCanvas("c12b", "Crystal 136", 750, 1000);  //create canvas
-
-//   gr_LTO_bef[2]->Draw("AP*");
-//   gr_LTO_bef[11]->Draw("PSAME*");
-//   c12b->Print("crystal136.pdf");
-//   TCanvas* c12c = new TCanvas("c12c", "Crystal 138", 750, 1000);  //create canvas
-
-//   gr_LTO_bef[3]->Draw("AP*");
-//   gr_LTO_bef[16]->Draw("PSAME*");
-//   c12c->Print("crystal138.pdf");
-//   TCanvas* c12d = new TCanvas("c12d", "Crystal 139", 750, 1000);  //create canvas
-
-//   gr_LTO_bef[4]->Draw("AP*");
-//   gr_LTO_bef[17]->Draw("PSAME*");
-//   c12d->Print("crystal139.pdf");
-//   TCanvas* c12e = new TCanvas("c12e", "Crystal 151", 750, 1000);  //create canvas
-
-//   gr_LTO_bef[5]->Draw("AP*");
-//   gr_LTO_bef[14]->Draw("PSAME*");
-//   c12e->Print("crystal151.pdf");
-//   TCanvas* c12f = new TCanvas("c12f", "Crystal 162", 750, 1000);  //create canvas
-
-//   gr_LTO_bef[6]->Draw("AP*");
-//   gr_LTO_bef[12]->Draw("PSAME*");
-//   c12f->Print("crystal162.pdf");
-//   TCanvas* c12g = new TCanvas("c12g", "Crystal 160", 750, 1000);  //create canvas
-
-//   gr_LTO_bef[7]->Draw("AP*");
-//   gr_LTO_bef[13]->Draw("PSAME*");
-//   c12g->Print("crystal162.pdf");
-//   TCanvas* c12h = new TCanvas("c12h", "Crystal 156", 750, 1000);  //create canvas
-
-//   gr_LTO_bef[8]->Draw("AP*");
-//   gr_LTO_bef[15]->Draw("PSAME*");
-//   c12h->Print("crystal156.pdf");
-
-
-  
+    // deltaK = (1/length) ln(LT_bef/LT_irr) and LT_irr/LT_bef for every pair at every wavelength (crystal_deltaK.h)
+    t0 = crystalNow();
+    deltaK.Compute(gieLT, giePairs, length);
+    gieStages.Add(kStageCompute, crystalNow() - t0, 2. * deltaK.NPairs() * Nwl * sizeof(double), (double)deltaK.NPairs() * Nwl);
+    {
+      CrystalLogLine line(kLogInfo);
+      line << "deltaK computed for " << deltaK.NPairs() << " crystals x " << deltaK.NWavelengths() << " wavelengths";
+      if (deltaK.NInvalid() > 0) line << " (" << deltaK.NInvalid() << " points with LT <= 0 set to NaN)";
+    }
+
+    // LT and deltaK at the evaluation wavelengths (LT360, LT420, LT620), looked up by wavelength on the
+    // grid of the file (crystal_wavelength.h); points, band averages or integrals can be added to gieBands
+    CrystalWavelengthIndex gieIndex(gieWL, Nwl);
+    if (!gieIndex.IsValid()) CRYSTAL_LOG(kLogQuiet) << "Warning: wavelength grid is not monotonic, no band values";
+    vector<CrystalBand> gieBands = crystalDefaultBands();
+    const int Nband = gieBands.size();
+    vector<double> gie_LTO_band;   // [iscan * Nband + iband]
+    vector<double> gie_DK_band;    // [ipair * Nband + iband]
+    t0 = crystalNow();
+    crystalExtractBands(gieIndex, gieLT[0], Nscan, Nwl, gieBands, gie_LTO_band);
+    crystalExtractBands(gieIndex, deltaK.DeltaK(0), deltaK.NPairs(), Nwl, gieBands, gie_DK_band);
+    gieStages.Add(kStageCompute, crystalNow() - t0, 0, (double)(Nscan + deltaK.NPairs()) * Nband);
+    for (int ip = 0; ip < deltaK.NPairs(); ip++) {
+      const CrystalPair& pair = deltaK.GetPair(ip);
+      for (int ib = 0; ib < Nband; ib++) {
+        double bef = gie_LTO_band[pair.before * Nband + ib];
+        double irr = gie_LTO_band[pair.after * Nband + ib];
+        CRYSTAL_LOG(kLogDebug) << "Crystal " << pair.crystal << " " << gieBands[ib].name << " : bef " << bef << " irr " << irr
+                               << " ratio " << irr / bef << " deltaK " << gie_DK_band[ip * Nband + ib];
+      }
+    }
+
+    // value, sigma and pass/fail of the 18 quantities for every crystal and their population
+    // statistics, in one parallel pass (crystal_quality.h); only the LT quantities are in the Giessen
+    // files, the others stay untested. Written as the "quality" and "quality_stats" trees.
+    t0 = crystalNow();
+    CrystalQualityConfig gieQualityConfig = opt.quality;
+    gieQualityConfig.nThreads = opt.nThreads;
+    CrystalQualitySummary gieQuality;
+    gieQuality.Compute(gieLT, giePairing, gieQualityConfig);
+    gieStages.Add(kStageCompute, crystalNow() - t0, 0, gieQuality.NCrystals());
+    for (int ic = 0; ic < gieQuality.NCrystals(); ic++) {
+      const CrystalQualityResult& r = gieQuality.GetResult(ic);
+      CRYSTAL_LOG(kLogDebug) << "Crystal " << r.crystal << " : LT360 " << r.value[kQuantityLT360] << " LT420 "
+                             << r.value[kQuantityLT420] << " LT620 " << r.value[kQuantityLT620] << " -> "
+                             << (r.status[kQuantityALL] == kQualityPass ? "pass" : r.status[kQuantityALL] == kQualityFail ? "FAIL" : "untested");
+    }
+    for (int q = 0; q < kNQuantity; q++) {
+      const CrystalQuantityStats& st = gieQuality.GetStats(q);
+      if (st.ntested == 0) continue;
+      if (st.nvalues == 0)
+        CRYSTAL_LOG(kLogInfo) << crystalQuantityName(q) << " : " << st.npass << " pass, " << st.nfail << " fail";
+      else
+        CRYSTAL_LOG(kLogInfo) << crystalQuantityName(q) << " : " << st.npass << " pass, " << st.nfail << " fail; mean " << st.mean
+                              << " rms " << st.RMS() << " min " << st.min << " max " << st.max << " over " << st.nvalues << " values";
+    }
+    t0 = crystalNow();
+    if (!writeCrystalQualityTrees(opt.tree.fileName, gieQuality))
+      CRYSTAL_LOG(kLogQuiet) << "Warning: quality summary could not be written to " << opt.tree.fileName;
+    // absorption band fit of every deltaK spectrum on the thread pool (crystal_fit.h)
+    if (opt.fit) {
+      CrystalFitConfig gieFitConfig = opt.fitConfig;
+      gieFitConfig.nThreads = opt.nThreads;
+      const double tfit = crystalNow();
+      CrystalBandFitter gieFitter;
+      gieFitter.Fit(deltaK, gieWL, gieFitConfig);
+      int nfitOk = 0, nfitSeeded = 0;
+      long nfitIter = 0;
+      for (int i = 0; i < gieFitter.NResults(); i++) {
+        const CrystalFitResult& r = gieFitter.GetResult(i);
+        nfitOk += r.status == kFitOk;
+        nfitSeeded += r.seeded;
+        nfitIter += r.iterations;
+        CRYSTAL_LOG(kLogDebug) << "Crystal " << r.crystal << " fit status " << r.status << " rms " << r.RMS() << " 1/m, "
+                               << r.iterations << " iterations" << (r.seeded ? " (seeded)" : "");
+      }
+      gieStages.Add(kStageCompute, crystalNow() - tfit, 0, nfitIter);
+      CRYSTAL_LOG(kLogInfo) << "Fitted " << gieFitConfig.bands.size() << " absorption bands to " << gieFitter.NResults() << " deltaK spectra: "
+                            << nfitOk << " converged, " << nfitSeeded << " seeded from the previous crystal, "
+                            << (gieFitter.NResults() > 0 ? (double)nfitIter / gieFitter.NResults() : 0.) << " iterations per fit";
+      if (!writeCrystalFitTree(opt.tree.fileName, gieFitter, gieFitConfig))
+        CRYSTAL_LOG(kLogQuiet) << "Warning: fit results could not be written to " << opt.tree.fileName;
+    }
+    // bef/irr spectra side by side, the input of the RDataFrame analysis (crystal_analysis.cc); rebuilt
+    // from all scans on an incremental run, so new irr scans pair with bef scans of earlier runs
+    if (!writeCrystalPairsTree(opt.tree, gieLT, giePairs))
+      CRYSTAL_LOG(kLogQuiet) << "Warning: pairs tree could not be written to " << opt.tree.fileName;
+    // the trees just replaced are dead space in the file; copy it to a fresh one when that has grown
+    // beyond its live size (crystal_treeWriter.h), so a long watch keeps the output bounded
+    if (gieIncremental.append) {
+      const Long64_t saved = crystalCompactFile(opt.tree.fileName);
+      if (saved < 0) CRYSTAL_LOG(kLogQuiet) << "Warning: " << opt.tree.fileName << " could not be compacted";
+      else if (saved > 0) CRYSTAL_LOG(kLogInfo) << "Compacted " << opt.tree.fileName << ": " << saved << " bytes of replaced trees removed";
+    }
+    gieStages.Add(kStageWrite, crystalNow() - t0, 0, gieQuality.NCrystals() + giePairs.size());
+
+    // bef/irr overlay and deltaK of every pair, one page each, in batch mode (crystal_plots.h)
+    if (opt.plots) {
+      crystalLogger().Flush();   // before the plot workers fork
+      int nfailed = renderCrystalPlots(gieLT, deltaK, opt.plot);
+      if (nfailed > 0) CRYSTAL_LOG(kLogQuiet) << "Warning: " << nfailed << " plot file(s) could not be written";
+      else CRYSTAL_LOG(kLogInfo) << "Plots of " << deltaK.NPairs() << " crystals written to " << opt.plot.fileName
+                                 << (opt.plot.perFile && gie_LTO.NFiles() > 1 ? " (one file per csv file)" : "");
+    }
 
+    return finishCrystalDataReader(opt, gieStages, kReaderOk);
   }
- 
+
+
+// Watch mode: an incremental run every opt.watchSeconds, so new scans are in the output within one
+// interval of being saved. Runs until killed, or until an error that another pass would repeat.
+int watchCrystalDataReader(const CrystalReaderOptions& opt)
+{
+    CRYSTAL_LOG(kLogQuiet) << "Watching " << opt.inputs.size() << " input(s) every " << opt.watchSeconds << " s, output " << opt.tree.fileName;
+    crystalLogger().Flush();
+    CrystalReaderOptions pass = opt;
+    pass.incremental = true;
+    for (;;) {
+      const int code = runCrystalDataReader(pass);
+      if (code != kReaderOk && code != kReaderNoInput) return code;   // no input yet is not an error
+      std::this_thread::sleep_for(std::chrono::duration<double>(opt.watchSeconds));
+    }
+}
+
+
+// Macro entry point
+// inputFiles  : whitespace separated list of Giessen csv files or globs, e.g. "GiessenData/BOX*_PROD.csv";
+//               several files are read in parallel and merged (see crystal_campaign.h). Required: without
+//               it the macro prints its usage and returns kReaderUsage
+// outFileName : ROOT file receiving the "crystals" tree (see crystal_treeWriter.h)
+// compAlgorithm, compLevel : output compression (1 = zlib, 2 = lzma, 4 = lz4, 5 = zstd; level 0-9)
+// basketSize  : branch basket size in bytes
+// nThreads    : worker threads for reading the files, 0 == one per core
+// useCache    : keep the parsed files in binary sidecars "<file>.ltcache" and load those while the csv is
+//               unchanged (see crystal_cache.h)
+// length      : crystal length in m
+// plotFile    : multi-page PDF (or .root file of graphs) with the bef/irr LT and deltaK of every crystal,
+//               empty for no plots (see crystal_plots.h)
+// cacheDir    : directory for the sidecars, empty == next to each csv file
+int crystal_dataReader(const char* inputFiles = "",
+                       const char* outFileName = "crystal_LT.root", int compAlgorithm = 5, int compLevel = 5,
+                       int basketSize = 32000, int nThreads = 0, bool useCache = true, double length = 0.2,
+                       const char* plotFile = "crystal_LT_plots.pdf", const char* cacheDir = "")
+{
+  CrystalReaderOptions opt;
+  opt.inputs = crystalSplitList(inputFiles ? inputFiles : "");
+  if (opt.inputs.empty()) {
+    cerr << "usage: crystal_dataReader(\"file.csv|glob ...\", outFileName = \"crystal_LT.root\", compAlgorithm = 5,\n"
+         << "                          compLevel = 5, basketSize = 32000, nThreads = 0, useCache = true, length = 0.2,\n"
+         << "                          plotFile = \"crystal_LT_plots.pdf\", cacheDir = \"\")\n";
+    return kReaderUsage;
+  }
+  opt.tree = CrystalTreeConfig(outFileName);
+  opt.tree.compressionAlgorithm = compAlgorithm;
+  opt.tree.compressionLevel = compLevel;
+  opt.tree.basketSize = basketSize;
+  opt.nThreads = nThreads;
+  opt.cache = CrystalCacheConfig(useCache, cacheDir ? cacheDir : "");
+  opt.length = length;
+  opt.plots = plotFile && *plotFile;
+  if (opt.plots) opt.plot.fileName = plotFile;
+  return runCrystalDataReader(opt);
+}
+
+
+#ifdef CRYSTAL_STANDALONE
+// Compiled, batch-mode reader (see Makefile):
+//   crystal_dataReader [options] file.csv|glob ...
+
+#include <TROOT.h>
+#include <getopt.h>
+
+static void crystalReaderUsage(const char* prog)
+{
+  cerr << "usage: " << prog << " [options] file.csv|glob ...\n"
+       << "       " << prog << " [options] archived.root   (re-analyse the crystals tree of an earlier run)\n"
+       << "  -o, --output FILE       output ROOT file (crystal_LT.root)\n"
+       << "  -l, --length M          crystal length in m for deltaK (0.2)\n"
+       << "  -j, --threads N         reader threads, 0 == one per core (0)\n"
+       << "  -a, --algorithm N       compression: 1 zlib, 2 lzma, 4 lz4, 5 zstd (5)\n"
+       << "  -c, --level N           compression level 0-9 (5)\n"
+       << "  -b, --basket BYTES      branch basket size (32000)\n"
+       << "      --storage MODE      LT precision in the trees: double, float, or fixed[:BITS[:MIN:MAX]]\n"
+       << "                          fixed point, error <= (MAX-MIN)/2^(BITS+1) (double; fixed = 16 bits\n"
+       << "                          on -10:110 %)\n"
+       << "      --no-cache          always parse the csv text, no sidecars\n"
+       << "      --cache-dir DIR     keep the sidecars in DIR instead of next to the csv files\n"
+       << "      --incremental       append only the scans not yet in the output: new files and new\n"
+       << "                          scan columns (ingested files listed in OUTPUT.manifest)\n"
+       << "      --watch SECONDS     repeat the incremental run every SECONDS until killed\n"
+       << "      --stream MB         bounded-memory streaming: write the scans tree only, using about\n"
+       << "                          MB of memory for any number of scans ($TMPDIR for spill files)\n"
+       << "      --cut Q=MIN[:MAX]   acceptance cut of quantity Q, e.g. LT420=60 (LT360=35 LT420=60\n"
+       << "                          LT620=70); repeat for several quantities\n"
+       << "      --baseline FILE     csv file whose first scan is the baseline (dark) LT\n"
+       << "      --reference FILE    csv file whose first scan is the 100% reference LT\n"
+       << "      --scale FILE        \"wl scale\" text file; with any of these the corrected spectra\n"
+       << "                          are written as lt_corr and used for deltaK and the summary\n"
+       << "      --history FILE      append the scans to the multi-campaign history FILE\n"
+       << "      --campaign NAME     campaign name in the history (default: first input file name)\n"
+       << "      --history-crystal N print the history of crystal N (no input files needed)\n"
+       << "      --fit               fit every deltaK spectrum with Gaussian absorption bands in energy\n"
+       << "      --fit-band E[:W]    seed band centre and width in eV, repeat for several bands\n"
+       << "                          (3.5:0.35 2.95:0.35 2.0:0.4)\n"
+       << "  -q, --quiet             warnings and errors only\n"
+       << "  -v, --verbose           debug output: one line per scan, pair and band\n"
+       << "      --log-level L       quiet, info or debug (info)\n"
+       << "      --stats FILE        per-stage timing summary as JSON, - for stdout\n"
+       << "      --plots[=FILE]      plot bef/irr LT and deltaK of every crystal to FILE, .pdf or .root\n"
+       << "                          (crystal_LT_plots.pdf)\n"
+       << "      --plot-per-file     one plot file per csv file, FILE_<csv name>.pdf\n"
+       << "      --plot-workers N    processes rendering the plot files, 0 == one per core (0)\n"
+       << "  -h, --help              this message\n";
+}
+
+int main(int argc, char** argv)
+{
+  CrystalReaderOptions opt;
+  enum { kNoCache = 256, kCacheDir, kStream, kPlots, kPlotPerFile, kPlotWorkers, kLogLevel, kStats, kCut, kBaseline, kReference, kScale, kHistory, kCampaign, kHistoryCrystal, kFit, kFitBand, kStorage, kIncremental, kWatch };
+  static const struct option longopts[] = {
+    { "output",        required_argument, 0, 'o' },
+    { "length",        required_argument, 0, 'l' },
+    { "threads",       required_argument, 0, 'j' },
+    { "algorithm",     required_argument, 0, 'a' },
+    { "level",         required_argument, 0, 'c' },
+    { "basket",        required_argument, 0, 'b' },
+    { "no-cache",      no_argument,       0, kNoCache },
+    { "cache-dir",     required_argument, 0, kCacheDir },
+    { "storage",       required_argument, 0, kStorage },
+    { "stream",        required_argument, 0, kStream },
+    { "incremental",   no_argument,       0, kIncremental },
+    { "watch",         required_argument, 0, kWatch },
+    { "plots",         optional_argument, 0, kPlots },
+    { "plot-per-file", no_argument,       0, kPlotPerFile },
+    { "plot-workers",  required_argument, 0, kPlotWorkers },
+    { "quiet",         no_argument,       0, 'q' },
+    { "verbose",       no_argument,       0, 'v' },
+    { "log-level",     required_argument, 0, kLogLevel },
+    { "stats",         required_argument, 0, kStats },
+    { "cut",           required_argument, 0, kCut },
+    { "baseline",      required_argument, 0, kBaseline },
+    { "reference",     required_argument, 0, kReference },
+    { "scale",         required_argument, 0, kScale },
+    { "history",       required_argument, 0, kHistory },
+    { "campaign",      required_argument, 0, kCampaign },
+    { "history-crystal", required_argument, 0, kHistoryCrystal },
+    { "fit",           no_argument,       0, kFit },
+    { "fit-band",      required_argument, 0, kFitBand },
+    { "help",          no_argument,       0, 'h' },
+    { 0, 0, 0, 0 }
+  };
+  bool fitBands = false;   // the first --fit-band replaces the default bands
+  int c;
+  while ((c = getopt_long(argc, argv, "o:l:j:a:c:b:qvh", longopts, 0)) != -1) {
+    char* end = 0;
+    switch (c) {
+    case 'o': opt.tree.fileName = optarg; break;
+    case 'l': opt.length = strtod(optarg, &end); break;
+    case 'j': opt.nThreads = strtol(optarg, &end, 10); break;
+    case 'a': opt.tree.compressionAlgorithm = strtol(optarg, &end, 10); break;
+    case 'c': opt.tree.compressionLevel = strtol(optarg, &end, 10); break;
+    case 'b': opt.tree.basketSize = strtol(optarg, &end, 10); break;
+    case kNoCache: opt.cache.enabled = false; break;
+    case kCacheDir: opt.cache.dir = optarg; break;
+    case kStorage:
+      if (!crystalParseStorage(optarg, opt.tree)) end = optarg;
+      break;
+    case kIncremental: opt.incremental = true; break;
+    case kWatch: opt.watchSeconds = strtod(optarg, &end); opt.incremental = true; break;
+    case kStream: opt.streamMemory = (size_t)(strtod(optarg, &end) * (1 << 20)); break;
+    case kPlots: opt.plots = true; if (optarg) opt.plot.fileName = optarg; break;
+    case kPlotPerFile: opt.plot.perFile = true; break;
+    case kPlotWorkers: opt.plot.nWorkers = strtol(optarg, &end, 10); break;
+    case 'q': opt.logLevel = kLogQuiet; break;
+    case 'v': opt.logLevel = kLogDebug; break;
+    case kLogLevel:
+      if (!crystalParseLogLevel(optarg, opt.logLevel)) end = optarg;
+      break;
+    case kStats: opt.statsFile = optarg; break;
+    case kBaseline: opt.baselineFile = optarg; break;
+    case kReference: opt.referenceFile = optarg; break;
+    case kScale: opt.scaleFile = optarg; break;
+    case kHistory: opt.historyFile = optarg; break;
+    case kCampaign: opt.campaign = optarg; break;
+    case kHistoryCrystal: opt.historyCrystal = strtol(optarg, &end, 10); break;
+    case kFit: opt.fit = true; break;
+    case kFitBand:
+      if (!fitBands) opt.fitConfig.bands.clear();
+      fitBands = true;
+      opt.fit = true;
+      if (!crystalParseFitBand(optarg, opt.fitConfig)) end = optarg;
+      break;
+    case kCut:
+      if (!crystalParseCut(optarg, opt.quality)) end = optarg;
+      break;
+    case 'h': crystalReaderUsage(argv[0]); return kReaderOk;
+    default: crystalReaderUsage(argv[0]); return kReaderUsage;
+    }
+    if (end && (*end || end == optarg)) {
+      cerr << argv[0] << ": bad value '" << optarg << "'" << endl;
+      return kReaderUsage;
+    }
+  }
+  for (int i = optind; i < argc; i++) opt.inputs.push_back(argv[i]);
+  const bool lookupOnly = opt.historyCrystal >= 0 && !opt.historyFile.empty();
+  if ((opt.inputs.empty() && !lookupOnly) || !(opt.length > 0) || opt.tree.compressionLevel < 0 || opt.tree.compressionLevel > 9 ||
+      (opt.incremental && opt.streamMemory > 0) || opt.watchSeconds < 0) {
+    crystalReaderUsage(argv[0]);
+    return kReaderUsage;
+  }
+
+  gROOT->SetBatch(kTRUE);
+  if (opt.watchSeconds > 0) return watchCrystalDataReader(opt);
+  return runCrystalDataReader(opt);
+}
+#endif
@@ -0,0 +1,88 @@
+// crystal_deltaK.h - Radiation induced absorption for every bef/irr pair, over the full spectrum.
+//
+//   deltaK(wl) = (1/length) * ln(LT_bef(wl) / LT_irr(wl))      [1/m for length in m]
+//   ratio(wl)  = LT_irr(wl) / LT_bef(wl)
+//
+// Results are stored like the spectra: one contiguous row of NWavelengths() values per pair, in the
+// order of the pair table from crystal_pairing.h. Points where either transmission is zero,
+// negative or not a number have no meaningful deltaK; both values are set to NaN there and
+// counted in NInvalid().
+//
+// The inner loops run over contiguous rows without branches (the invalid points are masked with
+// selects), so they vectorise; with -O3 -fno-math-errno and glibc's libmvec the log is vectorised too.
+
+#ifndef CRYSTAL_DELTAK_H
+#define CRYSTAL_DELTAK_H
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "crystal_pairing.h"
+#include "crystal_spectra.h"
+
+
+class CrystalDeltaK {
+public:
+  CrystalDeltaK() : fNpair(0), fNwl(0), fLength(0), fNinvalid(0) {}
+
+  void Compute(const CrystalSpectra& spectra, const std::vector<CrystalPair>& pairs, double length)
+  {
+    fPairs    = pairs;
+    fNpair    = pairs.size();
+    fNwl      = spectra.NWavelengths();
+    fLength   = length;
+    fNinvalid = 0;
+    fDK.resize((size_t)fNpair * fNwl);
+    fRatio.resize((size_t)fNpair * fNwl);
+
+    const double invLength = 1. / length;
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    const int nwl = fNwl;
+    for (int ip = 0; ip < fNpair; ip++) {
+      const double* __restrict bef   = spectra[pairs[ip].before];
+      const double* __restrict irr   = spectra[pairs[ip].after];
+      double*       __restrict dk    = &fDK[(size_t)ip * nwl];
+      double*       __restrict ratio = &fRatio[(size_t)ip * nwl];
+
+      // ratio with invalid points replaced by 1, so that the log below is always defined
+      long ninvalid = 0;
+      for (int j = 0; j < nwl; j++) {
+        const bool valid = bef[j] > 0 && irr[j] > 0;   // false for NaN as well
+        ratio[j] = valid ? irr[j] / bef[j] : 1.;
+        ninvalid += !valid;
+      }
+      for (int j = 0; j < nwl; j++) dk[j] = -invLength * std::log(ratio[j]);
+      if (ninvalid == 0) continue;
+
+      fNinvalid += ninvalid;
+      for (int j = 0; j < nwl; j++) {
+        const bool valid = bef[j] > 0 && irr[j] > 0;
+        dk[j]    = valid ? dk[j]    : nan;
+        ratio[j] = valid ? ratio[j] : nan;
+      }
+    }
+  }
+
+  int    NPairs()       const { return fNpair; }
+  int    NWavelengths() const { return fNwl; }
+  double Length()       const { return fLength; }
+  long   NInvalid()     const { return fNinvalid; }
+
+  const CrystalPair& GetPair(int ipair) const { return fPairs[ipair]; }
+
+  // deltaK and LT ratio spectra of one pair: NWavelengths() contiguous values
+  const double* DeltaK(int ipair) const { return fDK.data() + (size_t)ipair * fNwl; }
+  const double* Ratio(int ipair)  const { return fRatio.data() + (size_t)ipair * fNwl; }
+
+private:
+  std::vector<CrystalPair> fPairs;
+  int                      fNpair;
+  int                      fNwl;
+  double                   fLength;
+  long                     fNinvalid;
+  std::vector<double>      fDK;
+  std::vector<double>      fRatio;
+};
+
+#endif
@@ -0,0 +1,354 @@
+// crystal_fit.h - Batch fit of the radiation induced absorption spectra (crystal_deltaK.h).
+//
+// Every deltaK spectrum is fitted, in photon energy, to a sum of Gaussian absorption bands on a
+// constant offset:
+//
+//   deltaK(E) = offset + sum_k A_k exp(-(E - E_k)^2 / (2 w_k^2))      E = 1239.84 eV nm / wl
+//
+// by unweighted least squares (Levenberg-Marquardt with analytic derivatives) over the points of
+// [wlMin, wlMax] where deltaK is defined. Band centres are kept inside the fitted energy range and
+// widths within [minWidth, maxWidth]; amplitudes are free (negative for bands that anneal).
+//
+// The fits are independent, so CrystalBandFitter::Fit() splits the pairs into one contiguous range
+// per worker thread (crystal_parallel.h). Within a range each fit starts from the result of the
+// previous converged fit - neighbouring crystals of a batch have similar spectra, so this typically
+// cuts the iterations two- to three-fold - and falls back to the configured seeds if the seeded fit
+// does not converge.
+// Results can therefore differ in the last digits with the number of threads, not beyond the tolerance.
+// Parameter errors are from the covariance matrix scaled by chi2/ndf.
+
+#ifndef CRYSTAL_FIT_H
+#define CRYSTAL_FIT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "crystal_deltaK.h"
+#include "crystal_parallel.h"
+
+
+const double kCrystalHcNm = 1239.84198;   // h c in eV nm
+
+// One absorption band: centre and width in eV, amplitude in 1/m
+struct CrystalAbsorptionBand {
+  double energy;
+  double width;
+  double amplitude;
+
+  CrystalAbsorptionBand(double e = 0, double w = 0.3, double a = 0) : energy(e), width(w), amplitude(a) {}
+};
+
+struct CrystalFitConfig {
+  std::vector<CrystalAbsorptionBand> bands;   // number of bands and their seeds
+  double wlMin;           // nm, fit range
+  double wlMax;
+  bool   offset;          // fit a constant term
+  double minWidth;        // eV
+  double maxWidth;
+  int    maxIterations;
+  double tolerance;       // relative chi2 change at convergence
+  int    nThreads;        // 0 == one per core
+
+  // Induced absorption bands of PbWO4 around 350, 420 and 620 nm
+  CrystalFitConfig()
+    : wlMin(330), wlMax(800), offset(true), minWidth(0.05), maxWidth(1.5), maxIterations(100), tolerance(1e-7), nThreads(0)
+  {
+    bands.push_back(CrystalAbsorptionBand(3.5, 0.35));
+    bands.push_back(CrystalAbsorptionBand(2.95, 0.35));
+    bands.push_back(CrystalAbsorptionBand(2.0, 0.4));
+  }
+
+  int NParameters() const { return 3 * bands.size() + (offset ? 1 : 0); }
+};
+
+// Add a seed band from "E" or "E:W" (eV), e.g. "2.9:0.3". Returns false for a malformed value.
+inline bool crystalParseFitBand(const char* text, CrystalFitConfig& config)
+{
+  char* stop;
+  CrystalAbsorptionBand band;
+  band.energy = std::strtod(text, &stop);
+  if (stop == text || !(band.energy > 0)) return false;
+  if (*stop == ':') {
+    const char* w = stop + 1;
+    band.width = std::strtod(w, &stop);
+    if (stop == w || !(band.width > 0)) return false;
+  }
+  if (*stop) return false;
+  config.bands.push_back(band);
+  return true;
+}
+
+
+enum ECrystalFitStatus {
+  kFitOk           = 0,
+  kFitNoData       = 1,   // fewer valid points than parameters
+  kFitNotConverged = 2,   // iteration limit reached, no step lowers chi2, or chi2 not finite
+  kFitSingular     = 3    // normal matrix singular (a band without points under it)
+};
+
+// Fit of one pair. par: A, E, w of every band, then the offset; err likewise.
+struct CrystalFitResult {
+  int                 crystal;
+  int                 pair;         // index in the CrystalDeltaK pair table
+  int                 status;       // ECrystalFitStatus
+  bool                seeded;       // started from the previous fit
+  int                 npoints;
+  int                 ndf;
+  int                 iterations;
+  double              chi2;         // sum of squared residuals, (1/m)^2
+  std::vector<double> par;
+  std::vector<double> err;
+
+  double RMS() const { return ndf > 0 ? std::sqrt(chi2 / ndf) : 0.; }
+};
+
+
+class CrystalBandFitter {
+public:
+  CrystalBandFitter() {}
+
+  // Fit every pair of deltaK; wl is the grid deltaK was computed on
+  void Fit(const CrystalDeltaK& deltaK, const double* wl, const CrystalFitConfig& config = CrystalFitConfig())
+  {
+    const int npair = deltaK.NPairs();
+    const int nwl = deltaK.NWavelengths();
+    fResults.assign(npair, CrystalFitResult());
+
+    // fit points and their energies, common to all pairs
+    std::vector<int> rows;
+    std::vector<double> energy;
+    for (int j = 0; j < nwl; j++) {
+      if (!(wl[j] >= config.wlMin && wl[j] <= config.wlMax && wl[j] > 0)) continue;
+      rows.push_back(j);
+      energy.push_back(kCrystalHcNm / wl[j]);
+    }
+    const double emin = energy.empty() ? 0 : *std::min_element(energy.begin(), energy.end());
+    const double emax = energy.empty() ? 0 : *std::max_element(energy.begin(), energy.end());
+
+    crystalParallelRanges(npair, config.nThreads, [&](int, int begin, int end) {
+      Workspace ws(config.NParameters());
+      std::vector<double> previous;
+      for (int ip = begin; ip < end; ip++) {
+        CrystalFitResult& r = fResults[ip];
+        r.crystal = deltaK.GetPair(ip).crystal;
+        r.pair = ip;
+        const double* dk = deltaK.DeltaK(ip);
+        ws.x.clear();
+        ws.y.clear();
+        for (size_t k = 0; k < rows.size(); k++) {
+          if (!std::isfinite(dk[rows[k]])) continue;
+          ws.x.push_back(energy[k]);
+          ws.y.push_back(dk[rows[k]]);
+        }
+
+        r.seeded = !previous.empty();
+        if (r.seeded) {
+          r.par = previous;
+          FitOne(config, emin, emax, ws, r);
+        }
+        if (!r.seeded || r.status != kFitOk) {
+          r.seeded = false;
+          Seed(config, ws, r.par);
+          FitOne(config, emin, emax, ws, r);
+        }
+        if (r.status == kFitOk) previous = r.par;
+      }
+    });
+  }
+
+  int                     NResults()       const { return fResults.size(); }
+  const CrystalFitResult& GetResult(int i) const { return fResults[i]; }
+
+  // Model at energy e for parameters par (layout of CrystalFitResult::par)
+  static double Evaluate(const std::vector<double>& par, int nband, double e)
+  {
+    double f = (int)par.size() > 3 * nband ? par[3 * nband] : 0.;
+    for (int k = 0; k < nband; k++) {
+      const double u = (e - par[3 * k + 1]) / par[3 * k + 2];
+      f += par[3 * k] * std::exp(-0.5 * u * u);
+    }
+    return f;
+  }
+
+private:
+  // Scratch space of one worker
+  struct Workspace {
+    std::vector<double> x, y;                 // points
+    std::vector<double> alpha, beta, grad;    // normal matrix, gradient, derivatives at a point
+    std::vector<double> trial, a, delta;
+
+    explicit Workspace(int npar)
+      : alpha(npar * npar), beta(npar), grad(npar), trial(npar), a(npar * npar), delta(npar) {}
+  };
+
+  // Configured seeds, amplitudes from the data at the band centres
+  static void Seed(const CrystalFitConfig& config, const Workspace& ws, std::vector<double>& par)
+  {
+    const int nband = config.bands.size();
+    par.assign(config.NParameters(), 0.);
+    for (int k = 0; k < nband; k++) {
+      const CrystalAbsorptionBand& b = config.bands[k];
+      double nearest = 0, best = std::numeric_limits<double>::infinity();
+      for (size_t i = 0; b.amplitude == 0 && i < ws.x.size(); i++) {
+        if (std::fabs(ws.x[i] - b.energy) < best) {
+          best = std::fabs(ws.x[i] - b.energy);
+          nearest = ws.y[i];
+        }
+      }
+      par[3 * k] = b.amplitude != 0 ? b.amplitude : nearest;
+      par[3 * k + 1] = b.energy;
+      par[3 * k + 2] = b.width;
+    }
+  }
+
+  static void Constrain(const CrystalFitConfig& config, double emin, double emax, std::vector<double>& par)
+  {
+    for (size_t k = 0; k < config.bands.size(); k++) {
+      par[3 * k + 1] = std::min(std::max(par[3 * k + 1], emin), emax);
+      par[3 * k + 2] = std::min(std::max(par[3 * k + 2], config.minWidth), config.maxWidth);
+    }
+  }
+
+  static double Chi2(const std::vector<double>& par, int nband, const Workspace& ws)
+  {
+    double chi2 = 0;
+    for (size_t i = 0; i < ws.x.size(); i++) {
+      const double r = ws.y[i] - Evaluate(par, nband, ws.x[i]);
+      chi2 += r * r;
+    }
+    return chi2;
+  }
+
+  // Normal matrix alpha = J^T J and beta = J^T r at par
+  static void Normal(const std::vector<double>& par, int nband, bool offset, Workspace& ws)
+  {
+    const int npar = ws.beta.size();
+    std::fill(ws.alpha.begin(), ws.alpha.end(), 0.);
+    std::fill(ws.beta.begin(), ws.beta.end(), 0.);
+    for (size_t i = 0; i < ws.x.size(); i++) {
+      double f = offset ? par[3 * nband] : 0.;
+      for (int k = 0; k < nband; k++) {
+        const double a = par[3 * k], e = par[3 * k + 1], w = par[3 * k + 2];
+        const double u = (ws.x[i] - e) / w;
+        const double g = std::exp(-0.5 * u * u);
+        f += a * g;
+        ws.grad[3 * k]     = g;
+        ws.grad[3 * k + 1] = a * g * u / w;
+        ws.grad[3 * k + 2] = a * g * u * u / w;
+      }
+      if (offset) ws.grad[3 * nband] = 1.;
+      const double r = ws.y[i] - f;
+      for (int p = 0; p < npar; p++) {
+        ws.beta[p] += ws.grad[p] * r;
+        for (int q = 0; q <= p; q++) ws.alpha[p * npar + q] += ws.grad[p] * ws.grad[q];
+      }
+    }
+    for (int p = 0; p < npar; p++)
+      for (int q = 0; q < p; q++) ws.alpha[q * npar + p] = ws.alpha[p * npar + q];
+  }
+
+  // Solve a x = b in place (a is destroyed, x returned in b) by Gaussian elimination with partial
+  // pivoting. Returns false if a is singular.
+  static bool Solve(int n, double* a, double* b)
+  {
+    for (int c = 0; c < n; c++) {
+      int pivot = c;
+      for (int r = c + 1; r < n; r++)
+        if (std::fabs(a[r * n + c]) > std::fabs(a[pivot * n + c])) pivot = r;
+      if (!(std::fabs(a[pivot * n + c]) > 1e-300)) return false;
+      if (pivot != c) {
+        for (int k = 0; k < n; k++) std::swap(a[c * n + k], a[pivot * n + k]);
+        std::swap(b[c], b[pivot]);
+      }
+      for (int r = c + 1; r < n; r++) {
+        const double f = a[r * n + c] / a[c * n + c];
+        if (f == 0) continue;
+        for (int k = c; k < n; k++) a[r * n + k] -= f * a[c * n + k];
+        b[r] -= f * b[c];
+      }
+    }
+    for (int c = n - 1; c >= 0; c--) {
+      double s = b[c];
+      for (int k = c + 1; k < n; k++) s -= a[c * n + k] * b[k];
+      b[c] = s / a[c * n + c];
+    }
+    return true;
+  }
+
+  // Levenberg-Marquardt from r.par
+  static void FitOne(const CrystalFitConfig& config, double emin, double emax, Workspace& ws, CrystalFitResult& r)
+  {
+    const int nband = config.bands.size();
+    const int npar = config.NParameters();
+    r.npoints = ws.x.size();
+    r.ndf = r.npoints - npar;
+    r.iterations = 0;
+    r.err.assign(npar, 0.);
+    r.chi2 = 0;
+    if (r.ndf <= 0) {
+      r.status = kFitNoData;
+      return;
+    }
+    Constrain(config, emin, emax, r.par);
+    double chi2 = Chi2(r.par, nband, ws);
+    double lambda = 1e-3;
+    r.status = kFitNotConverged;
+    if (!std::isfinite(chi2)) {   // values beyond the range of a squared double
+      r.chi2 = chi2;
+      return;
+    }
+    for (r.iterations = 1; r.iterations <= config.maxIterations; r.iterations++) {
+      Normal(r.par, nband, config.offset, ws);
+      bool accepted = false, improved = false;
+      while (lambda < 1e12) {
+        ws.a = ws.alpha;
+        for (int p = 0; p < npar; p++) ws.a[p * npar + p] *= 1 + lambda;
+        ws.delta = ws.beta;
+        if (Solve(npar, &ws.a[0], &ws.delta[0])) {
+          for (int p = 0; p < npar; p++) ws.trial[p] = r.par[p] + ws.delta[p];
+          Constrain(config, emin, emax, ws.trial);
+          const double chi2Trial = Chi2(ws.trial, nband, ws);
+          if (chi2Trial <= chi2) {
+            accepted = true;
+            improved = chi2 - chi2Trial > config.tolerance * chi2;
+            std::copy(ws.trial.begin(), ws.trial.end(), r.par.begin());
+            chi2 = chi2Trial;
+            lambda = std::max(lambda * 0.1, 1e-12);
+            break;
+          }
+        }
+        lambda *= 10;
+      }
+      if (!accepted) break;   // no damped step lowers chi2: stuck at par, not a minimum found
+      if (!improved) {
+        r.status = kFitOk;   // converged to the tolerance
+        break;
+      }
+    }
+    r.iterations = std::min(r.iterations, config.maxIterations);
+    r.chi2 = chi2;
+
+    // errors: diagonal of (J^T J)^-1 chi2/ndf
+    Normal(r.par, nband, config.offset, ws);
+    const double scale = chi2 / r.ndf;
+    for (int p = 0; p < npar; p++) {
+      ws.a = ws.alpha;
+      std::fill(ws.delta.begin(), ws.delta.end(), 0.);
+      ws.delta[p] = 1;
+      if (!Solve(npar, &ws.a[0], &ws.delta[0])) {
+        if (r.status == kFitOk) r.status = kFitSingular;
+        std::fill(r.err.begin(), r.err.end(), 0.);
+        return;
+      }
+      r.err[p] = std::sqrt(std::max(ws.delta[p] * scale, 0.));
+    }
+  }
+
+  std::vector<CrystalFitResult> fResults;   // in the pair order of the deltaK table
+};
+
+#endif
@@ -0,0 +1,105 @@
+// crystal_fitWriter.h - Writes the absorption band fits (crystal_fit.h) next to the "crystals" tree.
+//
+// Tree "fits", one entry per bef/irr pair:
+//   crystal            /I   crystal number
+//   pair               /I   entry in "pairs"
+//   status             /I   ECrystalFitStatus: 0 ok, 1 no data, 2 not converged, 3 singular
+//   seeded             /O   started from the fit of the previous crystal
+//   npoints, ndf       /I
+//   iterations         /I
+//   chi2               /D   sum of squared residuals, (1/m)^2
+//   rms                /D   sqrt(chi2/ndf), 1/m
+//   amplitude[nband]   /D   band amplitude (1/m), with amplitude_err[nband]
+//   energy[nband]      /D   band centre (eV), with energy_err[nband]
+//   width[nband]       /D   band sigma (eV), with width_err[nband]
+//   offset, offset_err /D   constant term (0 when not fitted)
+// The seed bands are stored as the TVectorD "fit_seed_energy" and "fit_seed_width".
+
+#ifndef CRYSTAL_FITWRITER_H
+#define CRYSTAL_FITWRITER_H
+
+#include <TFile.h>
+#include <TString.h>
+#include <TTree.h>
+#include <TVectorD.h>
+
+#include <string>
+#include <vector>
+
+#include "crystal_fit.h"
+
+
+// Add the tree to fileName (existing "fits" replaced; its baskets stay in the file as dead space until
+// crystalCompactFile). Returns false if the file cannot be opened for update.
+inline bool writeCrystalFitTree(const std::string& fileName, const CrystalBandFitter& fitter, const CrystalFitConfig& config)
+{
+  TFile* file = TFile::Open(fileName.c_str(), "UPDATE");
+  if (!file || file->IsZombie()) {
+    delete file;
+    return false;
+  }
+
+  const int nband = config.bands.size();
+  const int n = nband > 0 ? nband : 1;
+  TVectorD seedEnergy(n), seedWidth(n);
+  for (int k = 0; k < nband; k++) {
+    seedEnergy[k] = config.bands[k].energy;
+    seedWidth[k]  = config.bands[k].width;
+  }
+  seedEnergy.Write("fit_seed_energy", TObject::kOverwrite);
+  seedWidth.Write("fit_seed_width", TObject::kOverwrite);
+
+  Int_t    crystal, pair, status, npoints, ndf, iterations;
+  Bool_t   seeded;
+  Double_t chi2, rms, offset, offsetErr;
+  std::vector<Double_t> amplitude(n), amplitudeErr(n), energy(n), energyErr(n), width(n), widthErr(n);
+  TTree* tree = new TTree("fits", "Absorption band fits of deltaK");
+  tree->Branch("crystal",       &crystal,         "crystal/I");
+  tree->Branch("pair",          &pair,            "pair/I");
+  tree->Branch("status",        &status,          "status/I");
+  tree->Branch("seeded",        &seeded,          "seeded/O");
+  tree->Branch("npoints",       &npoints,         "npoints/I");
+  tree->Branch("ndf",           &ndf,             "ndf/I");
+  tree->Branch("iterations",    &iterations,      "iterations/I");
+  tree->Branch("chi2",          &chi2,            "chi2/D");
+  tree->Branch("rms",           &rms,             "rms/D");
+  tree->Branch("amplitude",     &amplitude[0],    Form("amplitude[%d]/D", n));
+  tree->Branch("amplitude_err", &amplitudeErr[0], Form("amplitude_err[%d]/D", n));
+  tree->Branch("energy",        &energy[0],       Form("energy[%d]/D", n));
+  tree->Branch("energy_err",    &energyErr[0],    Form("energy_err[%d]/D", n));
+  tree->Branch("width",         &width[0],        Form("width[%d]/D", n));
+  tree->Branch("width_err",     &widthErr[0],     Form("width_err[%d]/D", n));
+  tree->Branch("offset",        &offset,          "offset/D");
+  tree->Branch("offset_err",    &offsetErr,       "offset_err/D");
+  for (int i = 0; i < fitter.NResults(); i++) {
+    const CrystalFitResult& r = fitter.GetResult(i);
+    crystal    = r.crystal;
+    pair       = r.pair;
+    status     = r.status;
+    seeded     = r.seeded;
+    npoints    = r.npoints;
+    ndf        = r.ndf;
+    iterations = r.iterations;
+    chi2       = r.chi2;
+    rms        = r.RMS();
+    const bool havePar = (int)r.par.size() >= 3 * nband && r.err.size() == r.par.size();
+    for (int k = 0; k < nband; k++) {
+      amplitude[k]    = havePar ? r.par[3 * k]     : 0;
+      energy[k]       = havePar ? r.par[3 * k + 1] : 0;
+      width[k]        = havePar ? r.par[3 * k + 2] : 0;
+      amplitudeErr[k] = havePar ? r.err[3 * k]     : 0;
+      energyErr[k]    = havePar ? r.err[3 * k + 1] : 0;
+      widthErr[k]     = havePar ? r.err[3 * k + 2] : 0;
+    }
+    offset    = havePar && config.offset ? r.par[3 * nband] : 0;
+    offsetErr = havePar && config.offset ? r.err[3 * nband] : 0;
+    tree->Fill();
+  }
+  tree->Write("", TObject::kOverwrite);
+
+  file->Close();
+  delete file;   // owns the tree
+  return true;
+}
+
+#endif
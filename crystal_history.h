@@ -0,0 +1,322 @@
+// crystal_history.h - Persistent history of every scan ingested, across test campaigns.
+//
+// One ROOT file accumulates the scans of all campaigns (Giessen and ACCOS test rounds, irradiation
+// rounds), so that a crystal can be followed from its first bef scan to its last annealing:
+//
+// Tree "campaigns", one entry per ingest:
+//   campaign   /I   campaign id (entry number)
+//   name       /C   campaign name, e.g. "BOX1_2_3_4_PROD"
+//   time       /L   ingest time (unix seconds)
+//   nscan      /I   scans of the campaign
+//   nwl        /I   wavelength points
+//   wl[nwl]    /D   wavelength grid of the campaign
+// Tree "history", one entry per scan:
+//   campaign   /I   id in "campaigns"
+//   file       /I   csv file, index in the TObjArray "history_files"
+//   crystal    /I   crystal number
+//   status     /I   ECrystalStatus
+//   scan       /I   scan number within the campaign
+//   nwl        /I
+//   lt[nwl]    /D   light transmission (%) on the grid of the campaign
+//
+// "history" is indexed on (crystal, status) with a TTreeIndex stored with the tree. It is rebuilt once per
+// session, on the first lookup or at Close() after scans were appended, never per campaign. The index
+// keeps its major (crystal) values sorted, so all scans of one crystal form a contiguous range of it:
+// History() binary-searches that range and reads only those entries, whatever the number of campaigns
+// in the file.
+
+#ifndef CRYSTAL_HISTORY_H
+#define CRYSTAL_HISTORY_H
+
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TObjString.h>
+#include <TString.h>
+#include <TTree.h>
+#include <TTreeIndex.h>
+
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+
+#include "crystal_spectra.h"
+
+
+const int kCrystalHistoryAnyStatus = -2;   // History(): scans of every status
+
+struct CrystalHistoryCampaign {
+  int                 id;
+  std::string         name;
+  Long64_t            time;
+  int                 nscan;
+  std::vector<double> wl;
+};
+
+// One scan of the history; lt is on the grid of its campaign
+struct CrystalHistoryScan {
+  Long64_t            entry;
+  int                 campaign;
+  int                 crystal;
+  int                 status;
+  int                 scan;
+  std::string         file;
+  std::vector<double> lt;
+};
+
+
+class CrystalHistoryDB {
+public:
+  CrystalHistoryDB()
+    : fFile(0), fCampaigns(0), fHistory(0), fOpen(-1), fOpenScans(0), fFileOffset(0), fCampaign(0), fTime(0), fNscan(0),
+      fNwl(0), fHistCampaign(0), fHistFile(0), fHistCrystal(0), fHistStatus(0), fHistScan(0), fHistNwl(0)
+  {
+    fName[0] = 0;
+  }
+
+  ~CrystalHistoryDB() { Close(); }
+
+  // Open (or create) the history file for update. Returns false if it cannot be opened.
+  bool Open(const std::string& fileName)
+  {
+    Close();
+    fFile = TFile::Open(fileName.c_str(), "UPDATE", "Crystal LT history");
+    if (!fFile || fFile->IsZombie()) {
+      delete fFile;
+      fFile = 0;
+      return false;
+    }
+    fFileNames.clear();
+    TObjArray* files = dynamic_cast<TObjArray*>(fFile->Get("history_files"));
+    for (int i = 0; files && i < files->GetEntries(); i++) {
+      TObjString* name = dynamic_cast<TObjString*>(files->At(i));
+      fFileNames.push_back(name ? name->GetString().Data() : "");
+    }
+    delete files;
+
+    fCampaigns = dynamic_cast<TTree*>(fFile->Get("campaigns"));
+    fHistory   = dynamic_cast<TTree*>(fFile->Get("history"));
+    if (!fCampaigns || !fHistory) {
+      fCampaigns = new TTree("campaigns", "Ingested test campaigns");
+      fCampaigns->Branch("campaign", &fCampaign, "campaign/I");
+      fCampaigns->Branch("name",     fName,      "name/C");
+      fCampaigns->Branch("time",     &fTime,     "time/L");
+      fCampaigns->Branch("nscan",    &fNscan,    "nscan/I");
+      fCampaigns->Branch("nwl",      &fNwl,      "nwl/I");
+      fHistory = new TTree("history", "LT scans of all campaigns");
+      fHistory->Branch("campaign", &fHistCampaign, "campaign/I");
+      fHistory->Branch("file",     &fHistFile,     "file/I");
+      fHistory->Branch("crystal",  &fHistCrystal,  "crystal/I");
+      fHistory->Branch("status",   &fHistStatus,   "status/I");
+      fHistory->Branch("scan",     &fHistScan,     "scan/I");
+      fHistory->Branch("nwl",      &fHistNwl,      "nwl/I");
+      // the variable-length branches are created by Reserve(), once the largest grid is known
+    }
+    else {
+      fCampaigns->SetBranchAddress("campaign", &fCampaign);
+      fCampaigns->SetBranchAddress("name",     fName);
+      fCampaigns->SetBranchAddress("time",     &fTime);
+      fCampaigns->SetBranchAddress("nscan",    &fNscan);
+      fCampaigns->SetBranchAddress("nwl",      &fNwl);
+      fHistory->SetBranchAddress("campaign", &fHistCampaign);
+      fHistory->SetBranchAddress("file",     &fHistFile);
+      fHistory->SetBranchAddress("crystal",  &fHistCrystal);
+      fHistory->SetBranchAddress("status",   &fHistStatus);
+      fHistory->SetBranchAddress("scan",     &fHistScan);
+      fHistory->SetBranchAddress("nwl",      &fHistNwl);
+      Reserve((int)fCampaigns->GetMaximum("nwl"));
+    }
+    return true;
+  }
+
+  bool IsOpen() const { return fFile != 0; }
+
+  int      NCampaigns() const { return fCampaigns ? (int)fCampaigns->GetEntries() : 0; }
+  Long64_t NScans()     const { return fHistory ? fHistory->GetEntries() : 0; }
+
+  // Start a campaign on the grid wl; files are the csv files that CrystalSpectra::Source() indexes.
+  // Returns the campaign id, -1 if the file is not open.
+  int BeginCampaign(const std::string& name, const double* wl, int nwl, const std::vector<std::string>& files)
+  {
+    if (!fFile) return -1;
+    if (fOpen >= 0) EndCampaign();
+    fOpen = NCampaigns();
+    fOpenName = name;
+    fOpenScans = 0;
+    fOpenWL.assign(wl, wl + nwl);
+    fFileOffset = fFileNames.size();
+    fFileNames.insert(fFileNames.end(), files.begin(), files.end());
+    Reserve(nwl);
+    return fOpen;
+  }
+
+  // Append the scans of spectra to the open campaign; file overrides the Source() of every scan
+  void AddScans(const CrystalSpectra& spectra, int file = -1)
+  {
+    if (fOpen < 0 || spectra.NWavelengths() != (int)fOpenWL.size()) return;
+    fHistCampaign = fOpen;
+    fHistNwl = fOpenWL.size();
+    for (int i = 0; i < spectra.NScans(); i++) {
+      fHistFile    = fFileOffset + (file >= 0 ? file : spectra.Source(i));
+      fHistCrystal = spectra.Crystal(i);
+      fHistStatus  = spectra.Status(i);
+      fHistScan    = fOpenScans++;
+      if (fHistNwl > 0) std::memcpy(&fLT[0], spectra[i], fHistNwl * sizeof(double));
+      fHistory->Fill();
+    }
+  }
+
+  // Close the open campaign: record it and write both trees (the index is brought up to date at Close()).
+  // Returns its scans.
+  int EndCampaign()
+  {
+    if (fOpen < 0) return 0;
+    fCampaign = fOpen;
+    std::strncpy(fName, fOpenName.c_str(), sizeof(fName) - 1);
+    fName[sizeof(fName) - 1] = 0;
+    fTime  = std::time(0);
+    fNscan = fOpenScans;
+    fNwl   = fOpenWL.size();
+    std::copy(fOpenWL.begin(), fOpenWL.end(), fWL.begin());
+    fCampaigns->Fill();
+    fOpen = -1;
+
+    fFile->cd();
+    TObjArray names;
+    names.SetOwner(kTRUE);
+    for (size_t i = 0; i < fFileNames.size(); i++) names.Add(new TObjString(fFileNames[i].c_str()));
+    names.Write("history_files", TObject::kSingleKey | TObject::kOverwrite);
+    fCampaigns->Write("", TObject::kOverwrite);
+    fHistory->Write("", TObject::kOverwrite);
+    return fNscan;
+  }
+
+  // Whole campaign in one call; returns the campaign id, -1 if the file is not open
+  int Append(const std::string& name, const CrystalSpectra& spectra)
+  {
+    const int id = BeginCampaign(name, spectra.WL(), spectra.NWavelengths(), spectra.FileNames());
+    AddScans(spectra);
+    EndCampaign();
+    return id;
+  }
+
+  bool GetCampaign(int id, CrystalHistoryCampaign& campaign)
+  {
+    if (id < 0 || id >= NCampaigns() || fCampaigns->GetEntry(id) <= 0) return false;
+    campaign.id    = fCampaign;
+    campaign.name  = fName;
+    campaign.time  = fTime;
+    campaign.nscan = fNscan;
+    campaign.wl.assign(fWL.begin(), fWL.begin() + fNwl);
+    return true;
+  }
+
+  // All scans of crystal (of one status, or kCrystalHistoryAnyStatus) in ingest order: an index range
+  // lookup, reading only the matching entries. Returns the number of scans.
+  int History(int crystal, std::vector<CrystalHistoryScan>& scans, int status = kCrystalHistoryAnyStatus)
+  {
+    scans.clear();
+    if (!fHistory || fHistory->GetEntries() == 0) return 0;
+    if (IndexStale()) fHistory->BuildIndex("crystal", "status");
+    TTreeIndex* index = dynamic_cast<TTreeIndex*>(fHistory->GetTreeIndex());
+    if (!index) return 0;
+    const Long64_t  n       = index->GetN();
+    const Long64_t* major   = index->GetIndexValues();        // crystal, sorted
+    const Long64_t* minor   = index->GetIndexValuesMinor();   // status, sorted within a crystal
+    const Long64_t* entries = index->GetIndex();
+    const Long64_t* lo = std::lower_bound(major, major + n, (Long64_t)crystal);
+    const Long64_t* hi = std::upper_bound(lo, major + n, (Long64_t)crystal);
+    for (const Long64_t* v = lo; v != hi; v++) {
+      if (status != kCrystalHistoryAnyStatus && minor[v - major] != status) continue;
+      const Long64_t entry = entries[v - major];
+      if (fHistory->GetEntry(entry) <= 0) continue;
+      CrystalHistoryScan s;
+      s.entry    = entry;
+      s.campaign = fHistCampaign;
+      s.crystal  = fHistCrystal;
+      s.status   = fHistStatus;
+      s.scan     = fHistScan;
+      s.file     = fHistFile >= 0 && fHistFile < (int)fFileNames.size() ? fFileNames[fHistFile] : "";
+      s.lt.assign(fLT.begin(), fLT.begin() + fHistNwl);
+      scans.push_back(s);
+    }
+    // equal keys are not ordered by entry within the index
+    std::sort(scans.begin(), scans.end(), [](const CrystalHistoryScan& a, const CrystalHistoryScan& b) { return a.entry < b.entry; });
+    return scans.size();
+  }
+
+  void Close()
+  {
+    if (!fFile) return;
+    EndCampaign();
+    if (IndexStale()) {
+      fHistory->BuildIndex("crystal", "status");
+      fFile->cd();
+      fHistory->Write("", TObject::kOverwrite);
+    }
+    fFile->Close();
+    delete fFile;   // owns the trees
+    fFile = 0;
+    fCampaigns = fHistory = 0;
+  }
+
+private:
+  CrystalHistoryDB(const CrystalHistoryDB&);
+  CrystalHistoryDB& operator=(const CrystalHistoryDB&);
+
+  // True if the index is missing or does not cover every entry (scans appended since it was built)
+  bool IndexStale() const
+  {
+    if (!fHistory || fHistory->GetEntries() == 0) return false;
+    TTreeIndex* index = dynamic_cast<TTreeIndex*>(fHistory->GetTreeIndex());
+    return !index || index->GetN() != fHistory->GetEntries();
+  }
+
+  // Grow the variable-length buffers to nwl points (re-pointing the branches if they moved)
+  void Reserve(int nwl)
+  {
+    if (nwl < 1) nwl = 1;
+    const bool create = !fCampaigns->GetBranch("wl");
+    if (!create && (int)fLT.size() >= nwl) return;
+    fWL.assign(std::max(nwl, (int)fWL.size()), 0.);
+    fLT.assign(fWL.size(), 0.);
+    if (create) {
+      fCampaigns->Branch("wl", &fWL[0], "wl[nwl]/D");
+      fHistory->Branch("lt", &fLT[0], "lt[nwl]/D");
+    }
+    else {
+      fCampaigns->SetBranchAddress("wl", &fWL[0]);
+      fHistory->SetBranchAddress("lt", &fLT[0]);
+    }
+  }
+
+  TFile*                   fFile;
+  TTree*                   fCampaigns;
+  TTree*                   fHistory;
+  std::vector<std::string> fFileNames;   // "history_files"
+
+  // campaign being ingested
+  int                      fOpen;        // its id, -1 if none
+  std::string              fOpenName;
+  int                      fOpenScans;
+  std::vector<double>      fOpenWL;
+  int                      fFileOffset;  // of its files in fFileNames
+
+  // branch buffers
+  Int_t                    fCampaign;
+  Char_t                   fName[256];
+  Long64_t                 fTime;
+  Int_t                    fNscan;
+  Int_t                    fNwl;
+  std::vector<Double_t>    fWL;
+  Int_t                    fHistCampaign;
+  Int_t                    fHistFile;
+  Int_t                    fHistCrystal;
+  Int_t                    fHistStatus;
+  Int_t                    fHistScan;
+  Int_t                    fHistNwl;
+  std::vector<Double_t>    fLT;
+};
+
+#endif
@@ -0,0 +1,123 @@
+// crystal_log.h - Leveled, buffered log output for the crystal readers.
+//
+// Messages are collected one line at a time and appended to an in-memory buffer that is written to
+// stdout in large pieces (and at exit / Flush()), so logging never flushes the terminal once per
+// line. Lines above the current level cost one comparison: CRYSTAL_LOG skips the whole stream
+// expression.
+//
+//   CRYSTAL_LOG(kLogInfo) << "Read " << n << " scans";     // no endl: each message is one line
+//   CrystalLogLine line(kLogInfo); line << a; if (b) line << c;   // line built in several statements
+
+#ifndef CRYSTAL_LOG_H
+#define CRYSTAL_LOG_H
+
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+
+enum ECrystalLogLevel {
+  kLogQuiet = 0,   // warnings and errors only; messages at this level are always written
+  kLogInfo  = 1,   // a few lines per file and stage (default)
+  kLogDebug = 2    // one line per scan, pair and band
+};
+
+
+class CrystalLogger {
+public:
+  static CrystalLogger& Instance()
+  {
+    static CrystalLogger logger;
+    return logger;
+  }
+
+  int  Level() const          { return fLevel; }
+  void SetLevel(int level)    { fLevel = level; }
+  bool Enabled(int level) const { return level <= fLevel; }
+
+  void Write(const std::string& text)
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    fBuffer += text;
+    if (fBuffer.size() >= kFlushBytes) FlushLocked();
+  }
+
+  void Flush()
+  {
+    std::lock_guard<std::mutex> lock(fMutex);
+    FlushLocked();
+  }
+
+  ~CrystalLogger() { Flush(); }
+
+private:
+  static const size_t kFlushBytes = 1 << 16;
+
+  CrystalLogger() : fLevel(kLogInfo) {}
+  CrystalLogger(const CrystalLogger&);
+  CrystalLogger& operator=(const CrystalLogger&);
+
+  void FlushLocked()
+  {
+    if (fBuffer.empty()) return;
+    std::fwrite(fBuffer.data(), 1, fBuffer.size(), stdout);
+    std::fflush(stdout);
+    fBuffer.clear();
+  }
+
+  int         fLevel;
+  std::string fBuffer;
+  std::mutex  fMutex;
+};
+
+inline CrystalLogger& crystalLogger() { return CrystalLogger::Instance(); }
+
+// "quiet", "info" or "debug" (or 0, 1, 2); returns false for anything else
+inline bool crystalParseLogLevel(const char* name, int& level)
+{
+  static const char* names[] = { "quiet", "info", "debug" };
+  for (int l = kLogQuiet; l <= kLogDebug; l++) {
+    if (std::strcmp(name, names[l]) == 0 || (name[0] == '0' + l && name[1] == 0)) {
+      level = l;
+      return true;
+    }
+  }
+  return false;
+}
+
+
+// One log message; written, with a newline, when it goes out of scope
+class CrystalLogLine {
+public:
+  explicit CrystalLogLine(int level) : fEnabled(crystalLogger().Enabled(level)) {}
+  ~CrystalLogLine()
+  {
+    if (!fEnabled) return;
+    fStream << '\n';
+    crystalLogger().Write(fStream.str());
+  }
+
+  template <class T> CrystalLogLine& operator<<(const T& value)
+  {
+    if (fEnabled) fStream << value;
+    return *this;
+  }
+
+private:
+  CrystalLogLine(const CrystalLogLine&);
+  CrystalLogLine& operator=(const CrystalLogLine&);
+
+  bool               fEnabled;
+  std::ostringstream fStream;
+};
+
+// Turns the stream expression into void, so that CRYSTAL_LOG can be a ?: expression (safe in if/else)
+struct CrystalLogVoidify {
+  void operator&(const CrystalLogLine&) {}
+};
+
+#define CRYSTAL_LOG(level) !crystalLogger().Enabled(level) ? (void)0 : CrystalLogVoidify() & CrystalLogLine(level)
+
+#endif
@@ -0,0 +1,150 @@
+// crystal_manifest.h - Record of the csv files already ingested into an output file, for incremental runs.
+//
+// Kept next to the output as "<output>.manifest", a text file:
+//   # crystal_dataReader manifest v1
+//   settings <text>                                   tree settings the output was written with
+//   <nscan> <size> <mtime> <key> <path>               one line per csv file
+// nscan is the number of scans of the file already in the output, size and mtime those of the file
+// when it was read, key a hash of the crystal number and status of those nscan scans
+// (crystalManifestScanKey), so a file whose first scans were edited in place is noticed. The path is
+// last on the line and may contain spaces.
+//
+// A file whose size and mtime match its entry is not opened at all. New scans are added to the Giessen
+// files as new columns, so a grown file is parsed again in full (every row gets a new cell) and only its
+// scans from nscan on are taken.
+
+#ifndef CRYSTAL_MANIFEST_H
+#define CRYSTAL_MANIFEST_H
+
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crystal_cache.h"
+#include "crystal_spectra.h"
+
+
+struct CrystalManifestEntry {
+  std::string file;
+  long long   size;
+  long long   mtime;   // unix seconds
+  int         nscan;   // scans of the file in the output
+  uint64_t    key;     // crystalManifestScanKey of those scans
+
+  CrystalManifestEntry() : size(-1), mtime(-1), nscan(0), key(0) {}
+};
+
+inline std::string crystalManifestPath(const std::string& output) { return output + ".manifest"; }
+
+// Size and modification time of path; false if it cannot be stat'ed
+inline bool crystalFileStat(const std::string& path, long long& size, long long& mtime)
+{
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0) return false;
+  size  = st.st_size;
+  mtime = st.st_mtime;
+  return true;
+}
+
+// Hash of the crystal number and status of scans [first, first + n) of spectra
+inline uint64_t crystalManifestScanKey(const CrystalSpectra& spectra, int first, int n)
+{
+  std::vector<int32_t> id(2 * (size_t)n);
+  for (int i = 0; i < n; i++) {
+    id[2 * i]     = spectra.Crystal(first + i);
+    id[2 * i + 1] = spectra.Status(first + i);
+  }
+  return crystalHash64((const char*)id.data(), id.size() * sizeof(int32_t));
+}
+
+
+class CrystalManifest {
+public:
+  // Read the manifest at path; false (and an empty manifest) if it is missing or not a manifest
+  bool Load(const std::string& path)
+  {
+    fEntries.clear();
+    fSettings.clear();
+    FILE* f = std::fopen(path.c_str(), "r");
+    if (!f) return false;
+    std::string line;
+    bool ok = ReadLine(f, line) && line == kHeader;
+    while (ok && ReadLine(f, line)) {
+      if (line.compare(0, 9, "settings ") == 0) { fSettings = line.substr(9); continue; }
+      CrystalManifestEntry e;
+      int n = 0;
+      if (std::sscanf(line.c_str(), "%d %lld %lld %" SCNx64 " %n", &e.nscan, &e.size, &e.mtime, &e.key, &n) < 4 || n == 0) {
+        ok = false;
+        break;
+      }
+      e.file = line.substr(n);
+      fEntries.push_back(e);
+    }
+    std::fclose(f);
+    if (!ok) fEntries.clear();
+    return ok;
+  }
+
+  // Write the manifest under a temporary name and rename it, so an interrupted run leaves the old one
+  bool Save(const std::string& path) const
+  {
+    const std::string tmp = path + ".tmp" + std::to_string((long)::getpid());
+    FILE* f = std::fopen(tmp.c_str(), "w");
+    if (!f) return false;
+    bool ok = std::fprintf(f, "%s\nsettings %s\n", kHeader, fSettings.c_str()) > 0;
+    for (size_t i = 0; ok && i < fEntries.size(); i++) {
+      const CrystalManifestEntry& e = fEntries[i];
+      ok = std::fprintf(f, "%d %lld %lld %016" PRIx64 " %s\n", e.nscan, e.size, e.mtime, e.key, e.file.c_str()) > 0;
+    }
+    ok = (std::fclose(f) == 0) && ok;
+    if (ok) ok = std::rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) std::remove(tmp.c_str());
+    return ok;
+  }
+
+  const std::string& Settings() const { return fSettings; }
+  void SetSettings(const std::string& settings) { fSettings = settings; }
+
+  int NFiles() const { return fEntries.size(); }
+  const CrystalManifestEntry& GetEntry(int i) const { return fEntries[i]; }
+
+  // Entry of file, 0 if it was never ingested
+  const CrystalManifestEntry* Find(const std::string& file) const
+  {
+    for (size_t i = 0; i < fEntries.size(); i++)
+      if (fEntries[i].file == file) return &fEntries[i];
+    return 0;
+  }
+
+  // Add the entry, or replace the one of the same file
+  void Set(const CrystalManifestEntry& entry)
+  {
+    for (size_t i = 0; i < fEntries.size(); i++)
+      if (fEntries[i].file == entry.file) { fEntries[i] = entry; return; }
+    fEntries.push_back(entry);
+  }
+
+  void Clear() { fEntries.clear(); fSettings.clear(); }
+
+private:
+  static bool ReadLine(FILE* f, std::string& line)
+  {
+    line.clear();
+    int c;
+    while ((c = std::fgetc(f)) != EOF && c != '\n') line += (char)c;
+    return c != EOF || !line.empty();
+  }
+
+  static constexpr const char* kHeader = "# crystal_dataReader manifest v1";
+
+  std::string                       fSettings;
+  std::vector<CrystalManifestEntry> fEntries;
+};
+
+#endif
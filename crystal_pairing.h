@@ -0,0 +1,101 @@
+// crystal_pairing.h - Groups the scans of a CrystalSpectra store by crystal number and status.
+//
+// One pass over the scans fills a hash index crystal number -> slot, where each slot holds the
+// scan number of every status (bef, irr, ann) that crystal was measured in. Pairs() then lists,
+// for every crystal measured in both of two states, the two scan numbers, in order of first
+// appearance in the file. The deltaK and LT ratio computations take that table directly, so
+// nothing depends on the order in which scans were written to the file.
+
+#ifndef CRYSTAL_PAIRING_H
+#define CRYSTAL_PAIRING_H
+
+#include <unordered_map>
+#include <vector>
+
+#include "crystal_spectra.h"
+
+
+// Scans of one crystal, -1 where a state was not measured
+struct CrystalScanIndex {
+  int crystal;
+  int scan[kNStatus];
+};
+
+// Two scans of the same crystal, e.g. before (bef) and after (irr) irradiation
+struct CrystalPair {
+  int crystal;
+  int before;
+  int after;
+};
+
+
+class CrystalPairing {
+public:
+  CrystalPairing() : fNduplicate(0), fNunknown(0) {}
+  explicit CrystalPairing(const CrystalSpectra& spectra) : fNduplicate(0), fNunknown(0) { Build(spectra); }
+
+  // Index every scan of spectra. If a crystal has several scans in the same state the first is
+  // kept and the others are counted in NDuplicates(); scans with an unknown state or crystal
+  // number are counted in NUnknown().
+  void Build(const CrystalSpectra& spectra)
+  {
+    fSlot.clear();
+    fCrystals.clear();
+    fNduplicate = fNunknown = 0;
+    const int nscan = spectra.NScans();
+    fSlot.reserve(nscan);
+    fCrystals.reserve(nscan);
+    for (int i = 0; i < nscan; i++) {
+      const int crystal = spectra.Crystal(i);
+      const int status  = spectra.Status(i);
+      if (crystal < 0 || status < 0 || status >= kNStatus) { fNunknown++; continue; }
+      std::pair<std::unordered_map<int, int>::iterator, bool> ins = fSlot.insert(std::make_pair(crystal, (int)fCrystals.size()));
+      if (ins.second) {
+        CrystalScanIndex entry;
+        entry.crystal = crystal;
+        for (int s = 0; s < kNStatus; s++) entry.scan[s] = -1;
+        fCrystals.push_back(entry);
+      }
+      int& scan = fCrystals[ins.first->second].scan[status];
+      if (scan < 0) scan = i;
+      else fNduplicate++;
+    }
+  }
+
+  int NCrystals()   const { return fCrystals.size(); }
+  int NDuplicates() const { return fNduplicate; }
+  int NUnknown()    const { return fNunknown; }
+
+  const CrystalScanIndex& GetCrystal(int i) const { return fCrystals[i]; }
+
+  // Scan number of crystal in the given state, -1 if it was not measured
+  int Scan(int crystal, int status) const
+  {
+    std::unordered_map<int, int>::const_iterator it = fSlot.find(crystal);
+    if (it == fSlot.end() || status < 0 || status >= kNStatus) return -1;
+    return fCrystals[it->second].scan[status];
+  }
+
+  // Every crystal measured in both states
+  std::vector<CrystalPair> Pairs(int before = kStatusBef, int after = kStatusIrr) const
+  {
+    std::vector<CrystalPair> pairs;
+    if (before < 0 || before >= kNStatus || after < 0 || after >= kNStatus) return pairs;
+    pairs.reserve(fCrystals.size());
+    for (size_t i = 0; i < fCrystals.size(); i++) {
+      const CrystalScanIndex& c = fCrystals[i];
+      if (c.scan[before] < 0 || c.scan[after] < 0) continue;
+      CrystalPair p = { c.crystal, c.scan[before], c.scan[after] };
+      pairs.push_back(p);
+    }
+    return pairs;
+  }
+
+private:
+  std::unordered_map<int, int>  fSlot;       // crystal number -> index in fCrystals
+  std::vector<CrystalScanIndex> fCrystals;   // in order of first appearance
+  int                           fNduplicate;
+  int                           fNunknown;
+};
+
+#endif
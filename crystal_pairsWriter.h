@@ -0,0 +1,70 @@
+// crystal_pairsWriter.h - Writes the bef/irr pairs (crystal_pairing.h) next to the "crystals" tree.
+//
+// Tree "pairs", one entry per crystal with a bef and an irr scan:
+//   crystal      /I   crystal number
+//   bef          /I   entry of the bef scan in "crystals"
+//   irr          /I   entry of the irr scan in "crystals"
+//   lt_bef[nwl]  /D   LT before irradiation (the corrected spectrum when the run applied a correction)
+//   lt_irr[nwl]  /D   LT after irradiation
+// The LT arrays use the storage mode of the "crystals" tree (CrystalTreeConfig::LeafType()), NaN
+// included (crystalEncodeLT / crystalDecodeLT).
+// Both spectra of a pair are in one entry, so the analysis of crystal_analysis.cc is a single pass over
+// independent entries that RDataFrame can split over threads; the grid is the TVectorD "wavelength".
+
+#ifndef CRYSTAL_PAIRSWRITER_H
+#define CRYSTAL_PAIRSWRITER_H
+
+#include <TFile.h>
+#include <TString.h>
+#include <TTree.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "crystal_pairing.h"
+#include "crystal_spectra.h"
+#include "crystal_treeWriter.h"
+
+
+// Add the tree to config.fileName (existing "pairs" replaced; its baskets stay in the file as dead space
+// until crystalCompactFile). Returns false if the file cannot be opened for update.
+inline bool writeCrystalPairsTree(const CrystalTreeConfig& config, const CrystalSpectra& spectra,
+                                  const std::vector<CrystalPair>& pairs)
+{
+  TFile* file = TFile::Open(config.fileName.c_str(), "UPDATE");
+  if (!file || file->IsZombie()) {
+    delete file;
+    return false;
+  }
+
+  const int nwl = spectra.NWavelengths() > 0 ? spectra.NWavelengths() : 1;
+  Int_t crystal, bef, irr;
+  std::vector<Double_t> ltBef(nwl, 0.), ltIrr(nwl, 0.);
+  TTree* tree = new TTree("pairs", "Giessen bef/irr LT pairs");
+  const std::string leaf = config.LeafType();
+  tree->Branch("crystal", &crystal,  "crystal/I", config.basketSize);
+  tree->Branch("bef",     &bef,      "bef/I",     config.basketSize);
+  tree->Branch("irr",     &irr,      "irr/I",     config.basketSize);
+  tree->Branch("lt_bef",  &ltBef[0], Form("lt_bef[%d]/%s", nwl, leaf.c_str()), config.basketSize);
+  tree->Branch("lt_irr",  &ltIrr[0], Form("lt_irr[%d]/%s", nwl, leaf.c_str()), config.basketSize);
+  for (size_t ip = 0; ip < pairs.size(); ip++) {
+    crystal = pairs[ip].crystal;
+    bef     = pairs[ip].before;
+    irr     = pairs[ip].after;
+    if (spectra.NWavelengths() > 0) {   // no rows: the spectra rows are empty
+      std::memcpy(&ltBef[0], spectra[bef], spectra.NWavelengths() * sizeof(double));
+      std::memcpy(&ltIrr[0], spectra[irr], spectra.NWavelengths() * sizeof(double));
+    }
+    crystalEncodeLT(config, &ltBef[0], spectra.NWavelengths());
+    crystalEncodeLT(config, &ltIrr[0], spectra.NWavelengths());
+    tree->Fill();
+  }
+  tree->Write("", TObject::kOverwrite);
+
+  file->Close();
+  delete file;   // owns the tree
+  return true;
+}
+
+#endif
@@ -0,0 +1,100 @@
+// crystal_parallel.h - Minimal worker pools for the independent per-file / per-crystal stages:
+//                      threads for computation, forked processes for work that is not thread safe
+//                      (ROOT graphics).
+
+#ifndef CRYSTAL_PARALLEL_H
+#define CRYSTAL_PARALLEL_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+// Number of workers to use for n items when nthreads threads are requested (0 == one per core)
+inline int crystalNumWorkers(int n, int nthreads)
+{
+  if (nthreads <= 0) nthreads = std::thread::hardware_concurrency();
+  if (nthreads <= 0) nthreads = 1;
+  return n < nthreads ? (n > 0 ? n : 1) : nthreads;
+}
+
+// Call func(i) for every i in [0, n) on a pool of worker threads. Items are handed out one at a
+// time, so uneven work (e.g. files of different size) balances itself. With a single worker
+// everything runs on the calling thread.
+inline void crystalParallelFor(int n, int nthreads, const std::function<void(int)>& func)
+{
+  const int nworkers = crystalNumWorkers(n, nthreads);
+  if (nworkers == 1) {
+    for (int i = 0; i < n; i++) func(i);
+    return;
+  }
+  std::atomic<int> next(0);
+  std::vector<std::thread> workers;
+  workers.reserve(nworkers);
+  for (int w = 0; w < nworkers; w++)
+    workers.push_back(std::thread([&]() {
+      for (int i = next++; i < n; i = next++) func(i);
+    }));
+  for (size_t w = 0; w < workers.size(); w++) workers[w].join();
+}
+
+// Split [0, n) into one contiguous range per worker thread and call func(worker, begin, end) for each,
+// for reductions: every worker accumulates into its own slot, the caller merges the slots afterwards.
+// Returns the number of workers (slots) used.
+inline int crystalParallelRanges(int n, int nthreads, const std::function<void(int, int, int)>& func)
+{
+  const int nworkers = crystalNumWorkers(n, nthreads);
+  crystalParallelFor(nworkers, nworkers, [&](int w) {
+    func(w, (int)((long)n * w / nworkers), (int)((long)n * (w + 1) / nworkers));
+  });
+  return nworkers;
+}
+
+// Call func(i) for every i in [0, n), each in its own forked process, at most nworkers (0 == one per
+// core) at a time. Children share nothing with the parent after the fork, so func must write its
+// results to files. Returns the number of items for which func returned false or the child died.
+// With a single worker everything runs in the calling process.
+inline int crystalParallelProcesses(int n, int nworkers, const std::function<bool(int)>& func)
+{
+  nworkers = crystalNumWorkers(n, nworkers);
+  int nfailed = 0;
+  if (nworkers == 1) {
+    for (int i = 0; i < n; i++) nfailed += !func(i);
+    return nfailed;
+  }
+  std::fflush(0);
+  // only the children forked here are waited for, so those of the caller (or of ROOT) are left alone
+  std::vector<pid_t> running;
+  for (int i = 0; i < n || !running.empty();) {
+    if (i < n && (int)running.size() < nworkers) {
+      pid_t pid = ::fork();
+      if (pid == 0) _exit(func(i) ? 0 : 1);
+      if (pid < 0) nfailed += !func(i);   // no more processes: do it here
+      else running.push_back(pid);
+      i++;
+      continue;
+    }
+    // reap any child of ours that has finished, else block on the oldest one
+    size_t k = 0;
+    int status = 0;
+    pid_t done = 0;
+    for (; k < running.size(); k++)
+      if ((done = ::waitpid(running[k], &status, WNOHANG)) != 0) break;
+    if (k == running.size()) {
+      k = 0;
+      while ((done = ::waitpid(running[0], &status, 0)) < 0 && errno == EINTR) {}
+    }
+    if (done < 0) status = -1;   // reaped elsewhere: its result is unknown
+    running.erase(running.begin() + k);
+    nfailed += !(done > 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  return nfailed;
+}
+
+#endif
@@ -0,0 +1,194 @@
+// crystal_plots.h - Batch rendering of the per-crystal plots: bef/irr LT overlay and deltaK spectrum.
+//
+// Every bef/irr pair of a CrystalDeltaK table gets one page: the two LT spectra on the upper pad and
+// deltaK on the lower pad. All pages are drawn on a single canvas with one set of graphs, refilled for
+// each crystal, and written to one multi-page PDF (Print("file.pdf[") ... Print("file.pdf]")). For a
+// ".root" output the graphs are written instead ("lt_bef_NNN", "lt_irr_NNN", "dk_NNN"), so they can be
+// restyled later without reading the csv files again.
+//
+// ROOT graphics is not thread safe, so when the plots are split into one output per source csv file
+// (CrystalPlotConfig::perFile) the files are rendered in forked worker processes (crystal_parallel.h).
+
+#ifndef CRYSTAL_PLOTS_H
+#define CRYSTAL_PLOTS_H
+
+#include <TCanvas.h>
+#include <TFile.h>
+#include <TGraph.h>
+#include <TLegend.h>
+#include <TROOT.h>
+#include <TString.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "crystal_deltaK.h"
+#include "crystal_parallel.h"
+#include "crystal_spectra.h"
+
+
+struct CrystalPlotConfig {
+  std::string fileName;   // .pdf (multi-page) or .root (graphs)
+  int         nWorkers;   // processes rendering the outputs of a per-file split, 0 == one per core
+  bool        perFile;    // one output per source csv file, "<name>_<csv file>.pdf"
+
+  CrystalPlotConfig(const char* name = "crystal_LT_plots.pdf") : fileName(name), nWorkers(0), perFile(false) {}
+};
+
+
+inline bool crystalPlotIsRoot(const std::string& file)
+{
+  return file.size() >= 5 && file.compare(file.size() - 5, 5, ".root") == 0;
+}
+
+// Output name for one part of a split: tag inserted before the extension
+inline std::string crystalPlotFileName(const std::string& file, const std::string& tag)
+{
+  if (tag.empty()) return file;
+  size_t dot = file.rfind('.');
+  size_t slash = file.rfind('/');
+  if (dot == std::string::npos || (slash != std::string::npos && dot < slash)) dot = file.size();
+  return file.substr(0, dot) + "_" + tag + file.substr(dot);
+}
+
+// Name of a csv file without directory and extension, used to tag its plot file
+inline std::string crystalPlotTag(const std::string& csv)
+{
+  size_t slash = csv.rfind('/');
+  std::string tag = slash == std::string::npos ? csv : csv.substr(slash + 1);
+  size_t dot = tag.rfind('.');
+  return dot == std::string::npos || dot == 0 ? tag : tag.substr(0, dot);
+}
+
+
+// Switches ROOT to batch mode for its lifetime and restores the previous mode, so rendering the plots
+// from an interactive session does not leave it without graphics
+class CrystalBatchMode {
+public:
+  CrystalBatchMode() : fWasBatch(gROOT->IsBatch()) { gROOT->SetBatch(kTRUE); }
+  ~CrystalBatchMode() { gROOT->SetBatch(fWasBatch); }
+
+private:
+  CrystalBatchMode(const CrystalBatchMode&);
+  CrystalBatchMode& operator=(const CrystalBatchMode&);
+
+  Bool_t fWasBatch;
+};
+
+
+// Render the pairs ipairs of deltaK (spectra from the store it was computed from) into one file.
+// Returns false if the output could not be written.
+inline bool renderCrystalPlotFile(const CrystalSpectra& spectra, const CrystalDeltaK& deltaK,
+                                  const std::vector<int>& ipairs, const std::string& file)
+{
+  CrystalBatchMode batch;
+  const int nwl = spectra.NWavelengths();
+  const double* wl = spectra.WL();
+  if (nwl < 2) return false;
+  const double wlMin = wl[0] < wl[nwl - 1] ? wl[0] : wl[nwl - 1];
+  const double wlMax = wl[0] < wl[nwl - 1] ? wl[nwl - 1] : wl[0];
+
+  // one set of graphs for all pages; fixed axis ranges, so the pages can be compared by eye
+  TGraph bef(nwl), irr(nwl), dk(nwl);
+  bef.SetMarkerStyle(7); bef.SetMarkerColor(1); bef.SetLineColor(1);
+  irr.SetMarkerStyle(7); irr.SetMarkerColor(2); irr.SetLineColor(2);
+  dk.SetMarkerStyle(7);  dk.SetMarkerColor(4);  dk.SetLineColor(4);
+
+  if (crystalPlotIsRoot(file)) {
+    TFile* out = TFile::Open(file.c_str(), "RECREATE");
+    if (!out || out->IsZombie()) {
+      delete out;
+      return false;
+    }
+    for (size_t k = 0; k < ipairs.size(); k++) {
+      const CrystalPair& pair = deltaK.GetPair(ipairs[k]);
+      const double* ltBef = spectra[pair.before];
+      const double* ltIrr = spectra[pair.after];
+      const double* dkRow = deltaK.DeltaK(ipairs[k]);
+      for (int j = 0; j < nwl; j++) {
+        bef.SetPoint(j, wl[j], ltBef[j]);
+        irr.SetPoint(j, wl[j], ltIrr[j]);
+        dk.SetPoint(j, wl[j], dkRow[j]);
+      }
+      bef.SetTitle(Form("Crystal %d bef;Wavelength (nm);LT (%%)", pair.crystal));
+      irr.SetTitle(Form("Crystal %d irr;Wavelength (nm);LT (%%)", pair.crystal));
+      dk.SetTitle(Form("Crystal %d;Wavelength (nm);#DeltaK (1/m)", pair.crystal));
+      bef.Write(Form("lt_bef_%d", pair.crystal));
+      irr.Write(Form("lt_irr_%d", pair.crystal));
+      dk.Write(Form("dk_%d", pair.crystal));
+    }
+    out->Close();
+    delete out;
+    return true;
+  }
+
+  TCanvas canvas("crystal_plots", "Giessen crystal LT", 750, 1000);
+  canvas.Divide(1, 2);
+  TLegend legend(0.75, 0.15, 0.87, 0.3);
+  legend.AddEntry(&bef, "bef", "p");
+  legend.AddEntry(&irr, "irr", "p");
+
+  std::remove(file.c_str());
+  canvas.Print((file + "[").c_str());
+  for (size_t k = 0; k < ipairs.size(); k++) {
+    const CrystalPair& pair = deltaK.GetPair(ipairs[k]);
+    const double* ltBef = spectra[pair.before];
+    const double* ltIrr = spectra[pair.after];
+    const double* dkRow = deltaK.DeltaK(ipairs[k]);
+    for (int j = 0; j < nwl; j++) {
+      bef.SetPoint(j, wl[j], ltBef[j]);
+      irr.SetPoint(j, wl[j], ltIrr[j]);
+      dk.SetPoint(j, wl[j], dkRow[j]);
+    }
+
+    TVirtualPad* pad = canvas.cd(1);
+    pad->Clear();
+    bef.SetTitle(Form("Crystal %d;Wavelength (nm);LT (%%)", pair.crystal));
+    bef.SetMinimum(0);
+    bef.SetMaximum(100);
+    bef.Draw("AP");
+    bef.GetXaxis()->SetLimits(wlMin, wlMax);
+    irr.Draw("P");
+    legend.Draw();
+
+    pad = canvas.cd(2);
+    pad->Clear();
+    dk.SetTitle(Form("Crystal %d;Wavelength (nm);#DeltaK (1/m)", pair.crystal));
+    dk.SetMinimum(-0.2);
+    dk.SetMaximum(1.5);
+    dk.Draw("AP");
+    dk.GetXaxis()->SetLimits(wlMin, wlMax);
+
+    canvas.Print(file.c_str(), Form("Title:Crystal %d", pair.crystal));
+  }
+  canvas.Print((file + "]").c_str());
+  return ::access(file.c_str(), F_OK) == 0;
+}
+
+// Render the plots of every pair of deltaK as configured. With config.perFile the pairs are grouped by
+// the csv file of their irr scan and the groups are rendered in parallel processes.
+// Returns the number of output files that could not be written.
+inline int renderCrystalPlots(const CrystalSpectra& spectra, const CrystalDeltaK& deltaK, const CrystalPlotConfig& config)
+{
+  const int ngroup = config.perFile && spectra.NFiles() > 1 ? spectra.NFiles() : 1;
+  std::vector<std::vector<int> > groups(ngroup);
+  for (int ip = 0; ip < deltaK.NPairs(); ip++)
+    groups[ngroup > 1 ? spectra.Source(deltaK.GetPair(ip).after) : 0].push_back(ip);
+
+  std::vector<int> todo;
+  std::vector<std::string> files;
+  for (int ig = 0; ig < ngroup; ig++) {
+    if (groups[ig].empty()) continue;
+    todo.push_back(ig);
+    files.push_back(ngroup > 1 ? crystalPlotFileName(config.fileName, crystalPlotTag(spectra.FileName(ig)))
+                               : config.fileName);
+  }
+  return crystalParallelProcesses(todo.size(), config.nWorkers, [&](int i) {
+    return renderCrystalPlotFile(spectra, deltaK, groups[todo[i]], files[i]);
+  });
+}
+
+#endif
@@ -0,0 +1,286 @@
+// crystal_quality.h - Per-crystal acceptance summary for the 18 test quantities of the crystal database.
+//
+// The quantities follow myname[] of crystal_dataReader.cc:
+//   AF BF3 BF4 CF AR BR3 BR4 CR L1 L2 L3 L4   dimensions (ACCOS), not in the Giessen LT files
+//   LY                                        light yield, not in the Giessen LT files
+//   LT360 LT420 LT620                         longitudinal LT (%) of the bef scan at 360/420/620 nm
+//   TTO                                       transverse transmission, not in the Giessen LT files
+//   ALL                                       overall: fails if any tested quantity fails
+// Quantities without a measurement are kQualityUntested, so the table can later be merged with the
+// ACCOS and light yield results without changing its layout.
+//
+// CrystalQualitySummary::Compute() makes one parallel pass over the crystals of a CrystalPairing
+// (crystal_parallel.h): each worker evaluates value, sigma and status of its range of crystals and
+// accumulates the population statistics of every quantity in its own slot; the slots are merged
+// at the end (count, mean and variance combine exactly).
+//
+// The sigma of an LT value is the spectrometer noise at that wavelength: the RMS of the bef
+// spectrum about a straight line fitted over +-sigmaWindow nm.
+
+#ifndef CRYSTAL_QUALITY_H
+#define CRYSTAL_QUALITY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "crystal_pairing.h"
+#include "crystal_parallel.h"
+#include "crystal_spectra.h"
+#include "crystal_wavelength.h"
+
+
+enum ECrystalQuantity {
+  kQuantityAF = 0, kQuantityBF3, kQuantityBF4, kQuantityCF,
+  kQuantityAR, kQuantityBR3, kQuantityBR4, kQuantityCR,
+  kQuantityL1, kQuantityL2, kQuantityL3, kQuantityL4,
+  kQuantityLY, kQuantityLT360, kQuantityLT420, kQuantityLT620, kQuantityTTO, kQuantityALL,
+  kNQuantity = 18
+};
+
+inline const char* crystalQuantityName(int q)
+{
+  static const char* names[kNQuantity] = { "AF", "BF3", "BF4", "CF", "AR", "BR3", "BR4", "CR", "L1",
+                                           "L2", "L3", "L4", "LY", "LT360", "LT420", "LT620", "TTO", "ALL" };
+  return q >= 0 && q < kNQuantity ? names[q] : "unknown";
+}
+
+enum ECrystalQuality {
+  kQualityUntested = 0,
+  kQualityPass     = 1,
+  kQualityFail     = 2
+};
+
+
+// Acceptance window of one quantity; values outside [min, max] fail
+struct CrystalCut {
+  double min;
+  double max;
+
+  CrystalCut(double lo = -std::numeric_limits<double>::infinity(), double hi = std::numeric_limits<double>::infinity())
+    : min(lo), max(hi) {}
+  bool Pass(double value) const { return value >= min && value <= max; }
+};
+
+struct CrystalQualityConfig {
+  CrystalCut cut[kNQuantity];
+  double     sigmaWindow;   // nm either side of the wavelength for the LT noise estimate
+  int        nThreads;      // 0 == one per core
+
+  // LT acceptance of the production crystals: LT360 >= 35 %, LT420 >= 60 %, LT620 >= 70 %, and all pass
+  CrystalQualityConfig() : sigmaWindow(5), nThreads(0)
+  {
+    cut[kQuantityLT360] = CrystalCut(35);
+    cut[kQuantityLT420] = CrystalCut(60);
+    cut[kQuantityLT620] = CrystalCut(70);
+    cut[kQuantityALL]   = CrystalCut(0, 0);   // number of failed quantities
+  }
+};
+
+
+// Set a cut from "NAME=MIN" or "NAME=MIN:MAX" (either bound may be empty), e.g. "LT420=60".
+// Returns false for an unknown quantity or a malformed value.
+inline bool crystalParseCut(const char* text, CrystalQualityConfig& config)
+{
+  const char* eq = std::strchr(text, '=');
+  if (!eq) return false;
+  int q = 0;
+  while (q < kNQuantity && !(std::strlen(crystalQuantityName(q)) == (size_t)(eq - text) &&
+                             std::strncmp(text, crystalQuantityName(q), eq - text) == 0)) q++;
+  if (q == kNQuantity) return false;
+  CrystalCut cut;
+  const char* p = eq + 1;
+  const char* colon = std::strchr(p, ':');
+  const char* minEnd = colon ? colon : p + std::strlen(p);
+  char* stop;
+  if (minEnd != p) {
+    cut.min = std::strtod(p, &stop);
+    if (stop != minEnd) return false;
+  }
+  if (colon && colon[1]) {
+    cut.max = std::strtod(colon + 1, &stop);
+    if (*stop) return false;
+  }
+  config.cut[q] = cut;
+  return true;
+}
+
+
+// Result for one crystal; value and sigma are NaN where untested
+struct CrystalQualityResult {
+  int   crystal;
+  int   scan;                  // bef scan the LT values were taken from, -1 if none
+  float value[kNQuantity];
+  float sigma[kNQuantity];
+  int   status[kNQuantity];    // ECrystalQuality
+  int   ntested;               // quantities with a measurement (ALL excluded)
+  bool  broken;                // bef spectrum unusable (NaN or LT <= 0) at a tested wavelength
+};
+
+// Population statistics of one quantity over the tested crystals. ntested counts every crystal with a
+// pass or fail status (npass + nfail == ntested); mean, RMS, minimum and maximum are over the nvalues
+// of them with a finite value, so a broken crystal that fails with a NaN is counted but not averaged.
+struct CrystalQuantityStats {
+  long   ntested;
+  long   npass;
+  long   nfail;
+  long   nvalues;
+  double mean;
+  double m2;     // sum of squared deviations from the mean
+  double min;
+  double max;
+
+  CrystalQuantityStats()
+    : ntested(0), npass(0), nfail(0), nvalues(0), mean(0), m2(0), min(std::numeric_limits<double>::infinity()),
+      max(-std::numeric_limits<double>::infinity()) {}
+
+  double RMS() const { return nvalues > 1 ? std::sqrt(m2 / (nvalues - 1)) : 0.; }
+
+  void Add(double value, int status)
+  {
+    if (status == kQualityUntested) return;
+    ntested++;
+    npass += status == kQualityPass;
+    nfail += status == kQualityFail;
+    if (!std::isfinite(value)) return;
+    nvalues++;
+    const double delta = value - mean;
+    mean += delta / nvalues;
+    m2 += delta * (value - mean);
+    if (value < min) min = value;
+    if (value > max) max = value;
+  }
+
+  void Merge(const CrystalQuantityStats& o)
+  {
+    ntested += o.ntested;
+    npass += o.npass;
+    nfail += o.nfail;
+    if (o.nvalues == 0) return;
+    const long n = nvalues + o.nvalues;
+    const double delta = o.mean - mean;
+    mean += delta * o.nvalues / n;
+    m2 += o.m2 + delta * delta * nvalues * o.nvalues / n;
+    nvalues = n;
+    if (o.min < min) min = o.min;
+    if (o.max > max) max = o.max;
+  }
+};
+
+
+class CrystalQualitySummary {
+public:
+  CrystalQualitySummary() {}
+
+  void Compute(const CrystalSpectra& spectra, const CrystalPairing& pairing,
+               const CrystalQualityConfig& config = CrystalQualityConfig())
+  {
+    static const int    ltQuantity[3]   = { kQuantityLT360, kQuantityLT420, kQuantityLT620 };
+    static const double ltWavelength[3] = { 360, 420, 620 };
+
+    // grid lookups shared by all crystals: interpolation weights and noise window per wavelength
+    const int nwl = spectra.NWavelengths();
+    CrystalWavelengthIndex index(spectra.WL(), nwl);
+    CrystalBandWeights weight[3];
+    int windowLo[3], windowHi[3];
+    for (int k = 0; k < 3; k++) {
+      weight[k] = crystalBandWeights(index, CrystalBand(crystalQuantityName(ltQuantity[k]), CrystalBand::kPoint, ltWavelength[k]));
+      int ra, rb;
+      double f;
+      const double lo = std::max(index.Min(), ltWavelength[k] - config.sigmaWindow);
+      const double hi = std::min(index.Max(), ltWavelength[k] + config.sigmaWindow);
+      windowLo[k] = windowHi[k] = 0;
+      if (weight[k].valid && index.Locate(lo, ra, f) && index.Locate(hi, rb, f)) {
+        windowLo[k] = std::min(ra, rb);
+        windowHi[k] = std::max(ra, rb) + 1;
+      }
+    }
+
+    const int ncrystal = pairing.NCrystals();
+    fResults.resize(ncrystal);
+    std::vector<std::vector<CrystalQuantityStats> > slots(crystalNumWorkers(ncrystal, config.nThreads));
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    crystalParallelRanges(ncrystal, config.nThreads, [&](int w, int begin, int end) {
+      std::vector<CrystalQuantityStats>& stats = slots[w];
+      stats.assign(kNQuantity, CrystalQuantityStats());
+      for (int ic = begin; ic < end; ic++) {
+        const CrystalScanIndex& c = pairing.GetCrystal(ic);
+        CrystalQualityResult& r = fResults[ic];
+        r.crystal = c.crystal;
+        r.scan = c.scan[kStatusBef];
+        r.ntested = 0;
+        r.broken = false;
+        for (int q = 0; q < kNQuantity; q++) {
+          r.value[q] = r.sigma[q] = nan;
+          r.status[q] = kQualityUntested;
+        }
+
+        if (r.scan >= 0) {
+          const double* lt = spectra[r.scan];
+          for (int k = 0; k < 3; k++) {
+            if (!weight[k].valid) continue;
+            double value = 0;
+            bool usable = true;
+            for (size_t j = 0; j < weight[k].row.size(); j++) {
+              const double v = lt[weight[k].row[j]];
+              usable = usable && v > 0;
+              value += weight[k].weight[j] * v;
+            }
+            const int q = ltQuantity[k];
+            r.ntested++;
+            if (!usable) {
+              r.broken = true;
+              r.status[q] = kQualityFail;
+              continue;
+            }
+            r.value[q] = value;
+            r.sigma[q] = Noise(spectra.WL(), lt, windowLo[k], windowHi[k]);
+            r.status[q] = config.cut[q].Pass(value) ? kQualityPass : kQualityFail;
+          }
+        }
+
+        // ALL: number of failed quantities, against its own cut (default: none may fail)
+        if (r.ntested > 0) {
+          int nfail = 0;
+          for (int q = 0; q < kQuantityALL; q++) nfail += r.status[q] == kQualityFail;
+          r.value[kQuantityALL] = nfail;
+          r.sigma[kQuantityALL] = 0;
+          r.status[kQuantityALL] = config.cut[kQuantityALL].Pass(nfail) ? kQualityPass : kQualityFail;
+        }
+        for (int q = 0; q < kNQuantity; q++) stats[q].Add(r.value[q], r.status[q]);
+      }
+    });
+
+    fStats.assign(kNQuantity, CrystalQuantityStats());
+    for (size_t w = 0; w < slots.size(); w++)
+      for (int q = 0; q < kNQuantity && !slots[w].empty(); q++) fStats[q].Merge(slots[w][q]);
+  }
+
+  int                         NCrystals()      const { return fResults.size(); }
+  const CrystalQualityResult& GetResult(int i) const { return fResults[i]; }
+  const CrystalQuantityStats& GetStats(int q)  const { return fStats[q]; }
+
+private:
+  // RMS about a least-squares line through rows [lo, hi) of lt; NaN with fewer than 3 usable points
+  static double Noise(const double* wl, const double* lt, int lo, int hi)
+  {
+    double n = 0, sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+    for (int j = lo; j < hi; j++) {
+      if (!std::isfinite(lt[j])) continue;
+      const double x = wl[j] - wl[lo], y = lt[j];
+      n++; sx += x; sy += y; sxx += x * x; sxy += x * y; syy += y * y;
+    }
+    if (n < 3) return std::numeric_limits<double>::quiet_NaN();
+    const double vxx = sxx - sx * sx / n, vxy = sxy - sx * sy / n, vyy = syy - sy * sy / n;
+    const double chi2 = vxx > 0 ? vyy - vxy * vxy / vxx : vyy;
+    return std::sqrt(std::max(chi2, 0.) / (n - 2));
+  }
+
+  std::vector<CrystalQualityResult> fResults;   // in the crystal order of the pairing
+  std::vector<CrystalQuantityStats> fStats;     // per ECrystalQuantity
+};
+
+#endif
@@ -0,0 +1,106 @@
+// crystal_qualityWriter.h - Writes a CrystalQualitySummary (crystal_quality.h) next to the "crystals" tree.
+//
+// Tree "quality", one entry per crystal:
+//   crystal      /I   crystal number
+//   scan         /I   entry of the bef scan in "crystals", -1 if there is none
+//   broken       /O   bef spectrum unusable at a tested wavelength
+//   ntested      /I   quantities with a measurement
+//   value[18]    /F   value of each quantity, NaN where untested (order of the TObjArray "quantities")
+//   sigma[18]    /F   its uncertainty
+//   status[18]   /b   ECrystalQuality: 0 untested, 1 pass, 2 fail
+// Tree "quality_stats", one entry per quantity: name, tested/passed/failed counts, the number of finite
+// values and their mean, RMS, minimum and maximum.
+
+#ifndef CRYSTAL_QUALITYWRITER_H
+#define CRYSTAL_QUALITYWRITER_H
+
+#include <TFile.h>
+#include <TObjArray.h>
+#include <TObjString.h>
+#include <TString.h>
+#include <TTree.h>
+
+#include <cstring>
+#include <string>
+
+#include "crystal_quality.h"
+
+
+// Add both trees to fileName (created if missing, existing trees of the same name replaced; their baskets
+// stay in the file as dead space until crystalCompactFile, crystal_treeWriter.h).
+// Returns false if the file cannot be opened for update.
+inline bool writeCrystalQualityTrees(const std::string& fileName, const CrystalQualitySummary& summary)
+{
+  TFile* file = TFile::Open(fileName.c_str(), "UPDATE");
+  if (!file || file->IsZombie()) {
+    delete file;
+    return false;
+  }
+
+  TObjArray names;
+  names.SetOwner(kTRUE);
+  for (int q = 0; q < kNQuantity; q++) names.Add(new TObjString(crystalQuantityName(q)));
+  names.Write("quantities", TObject::kSingleKey | TObject::kOverwrite);
+
+  Int_t   crystal, scan, ntested;
+  Bool_t  broken;
+  Float_t value[kNQuantity], sigma[kNQuantity];
+  UChar_t status[kNQuantity];
+  TTree* tree = new TTree("quality", "Giessen crystal acceptance summary");
+  tree->Branch("crystal", &crystal, "crystal/I");
+  tree->Branch("scan",    &scan,    "scan/I");
+  tree->Branch("broken",  &broken,  "broken/O");
+  tree->Branch("ntested", &ntested, "ntested/I");
+  tree->Branch("value",   value,    Form("value[%d]/F", (int)kNQuantity));
+  tree->Branch("sigma",   sigma,    Form("sigma[%d]/F", (int)kNQuantity));
+  tree->Branch("status",  status,   Form("status[%d]/b", (int)kNQuantity));
+  for (int i = 0; i < summary.NCrystals(); i++) {
+    const CrystalQualityResult& r = summary.GetResult(i);
+    crystal = r.crystal;
+    scan    = r.scan;
+    broken  = r.broken;
+    ntested = r.ntested;
+    std::memcpy(value, r.value, sizeof(value));
+    std::memcpy(sigma, r.sigma, sizeof(sigma));
+    for (int q = 0; q < kNQuantity; q++) status[q] = r.status[q];
+    tree->Fill();
+  }
+  tree->Write("", TObject::kOverwrite);
+
+  Int_t    quantity;
+  Char_t   name[16];
+  Long64_t ntest, npass, nfail, nvalues;
+  Double_t mean, rms, vmin, vmax;
+  TTree* stats = new TTree("quality_stats", "Acceptance statistics per quantity");
+  stats->Branch("quantity", &quantity, "quantity/I");
+  stats->Branch("name",     name,      "name/C");
+  stats->Branch("ntested",  &ntest,    "ntested/L");
+  stats->Branch("npass",    &npass,    "npass/L");
+  stats->Branch("nfail",    &nfail,    "nfail/L");
+  stats->Branch("nvalues",  &nvalues,  "nvalues/L");
+  stats->Branch("mean",     &mean,     "mean/D");
+  stats->Branch("rms",      &rms,      "rms/D");
+  stats->Branch("min",      &vmin,     "min/D");
+  stats->Branch("max",      &vmax,     "max/D");
+  for (quantity = 0; quantity < kNQuantity; quantity++) {
+    const CrystalQuantityStats& st = summary.GetStats(quantity);
+    std::strncpy(name, crystalQuantityName(quantity), sizeof(name) - 1);
+    name[sizeof(name) - 1] = 0;
+    ntest = st.ntested;
+    npass = st.npass;
+    nfail = st.nfail;
+    nvalues = st.nvalues;
+    mean  = st.mean;
+    rms   = st.RMS();
+    vmin  = st.nvalues > 0 ? st.min : 0;
+    vmax  = st.nvalues > 0 ? st.max : 0;
+    stats->Fill();
+  }
+  stats->Write("", TObject::kOverwrite);
+
+  file->Close();
+  delete file;   // owns the trees
+  return true;
+}
+
+#endif
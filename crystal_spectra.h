@@ -0,0 +1,159 @@
+// crystal_spectra.h - Heap-backed store for the LT spectra of one or more Giessen files.
+//
+// All spectra share one wavelength grid. LT values live in a single contiguous buffer,
+// one row of NWavelengths() doubles per scan, so a crystal's spectrum is a contiguous,
+// cache-friendly row and spectra[iscan][iwl] indexes like the old gie_LTO[Ngie][Ngiewl] array.
+// The store is sized from the file (number of traces and wavelength rows), not from fixed limits.
+// Spectra of several files on the same grid can be merged with Append(); each scan keeps the index
+// of the file it came from (Source()).
+
+#ifndef CRYSTAL_SPECTRA_H
+#define CRYSTAL_SPECTRA_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+
+// Measurement state of a scan, from the last field of the trace name
+enum ECrystalStatus {
+  kStatusUnknown = -1,
+  kStatusBef     =  0,   // before irradiation
+  kStatusIrr     =  1,   // after irradiation
+  kStatusAnn     =  2,   // after annealing
+  kNStatus       =  3
+};
+
+inline const char* crystalStatusName(int status)
+{
+  static const char* names[kNStatus] = { "bef", "irr", "ann" };
+  return status >= 0 && status < kNStatus ? names[status] : "unknown";
+}
+
+
+class CrystalSpectra {
+public:
+  CrystalSpectra() : fNscan(0), fNwl(0) {}
+
+  // Discard the contents and allocate nscan x nwl zeroed LT values
+  void Resize(int nscan, int nwl)
+  {
+    fNscan = nscan > 0 ? nscan : 0;
+    fNwl   = nwl   > 0 ? nwl   : 0;
+    fWL.assign(fNwl, 0.);
+    fLT.assign((size_t)fNscan * fNwl, 0.);
+    fCrystal.assign(fNscan, -1);
+    fStatus.assign(fNscan, -1);
+    fSource.assign(fNscan, 0);
+    fFiles.clear();
+  }
+
+  // Keep only the first nwl wavelengths of every scan (rows are compacted in place)
+  void ShrinkWavelengths(int nwl)
+  {
+    if (nwl < 0 || nwl >= fNwl) return;
+    for (int i = 1; i < fNscan; i++) std::memmove(&fLT[(size_t)i * nwl], &fLT[(size_t)i * fNwl], nwl * sizeof(double));
+    fNwl = nwl;
+    fWL.resize(nwl);
+    fLT.resize((size_t)fNscan * nwl);
+  }
+
+  int NScans()       const { return fNscan; }
+  int NWavelengths() const { return fNwl; }
+
+  double*       WL()       { return fWL.empty() ? 0 : &fWL[0]; }
+  const double* WL() const { return fWL.empty() ? 0 : &fWL[0]; }
+
+  // LT spectrum of one scan: NWavelengths() contiguous values
+  double*       Row(int iscan)       { return fLT.data() + (size_t)iscan * fNwl; }
+  const double* Row(int iscan) const { return fLT.data() + (size_t)iscan * fNwl; }
+  double*       operator[](int iscan)       { return Row(iscan); }
+  const double* operator[](int iscan) const { return Row(iscan); }
+
+  int  Crystal(int iscan) const { return fCrystal[iscan]; }
+  int  Status(int iscan)  const { return fStatus[iscan]; }
+  void SetScan(int iscan, int crystal, int status) { fCrystal[iscan] = crystal; fStatus[iscan] = status; }
+
+  // Source files: Source(iscan) indexes FileName()
+  int                NFiles()             const { return fFiles.size(); }
+  const std::vector<std::string>& FileNames() const { return fFiles; }
+  const std::string& FileName(int ifile)  const { return fFiles[ifile]; }
+  int                Source(int iscan)    const { return fSource[iscan]; }
+  void               SetFileName(const std::string& name) { fFiles.assign(1, name); }
+  void               SetFileNames(const std::vector<std::string>& names) { fFiles = names; }
+  void               SetSource(int iscan, int ifile) { fSource[iscan] = ifile; }
+
+  // True if other has the same wavelength grid, within tolerance (nm)
+  bool SameGrid(const CrystalSpectra& other, double tolerance = 1e-3) const
+  {
+    if (other.fNwl != fNwl) return false;
+    for (int i = 0; i < fNwl; i++)
+      if (!(std::fabs(other.fWL[i] - fWL[i]) <= tolerance)) return false;
+    return true;
+  }
+
+  // Reserve room for nscan scans in total, to avoid reallocation while appending
+  void Reserve(int nscan, int nwl)
+  {
+    fLT.reserve((size_t)nscan * nwl);
+    fCrystal.reserve(nscan);
+    fStatus.reserve(nscan);
+    fSource.reserve(nscan);
+  }
+
+  // Append all scans of other, which must be on the same grid (an empty store takes other's grid).
+  // Returns false, and leaves the store unchanged, if the grids differ.
+  bool Append(const CrystalSpectra& other)
+  {
+    if (fNscan == 0 && fFiles.empty()) {
+      fNwl = other.fNwl;
+      fWL  = other.fWL;
+    }
+    else if (!SameGrid(other)) return false;
+    const int nfile = fFiles.size();
+    fLT.insert(fLT.end(), other.fLT.begin(), other.fLT.end());
+    fCrystal.insert(fCrystal.end(), other.fCrystal.begin(), other.fCrystal.end());
+    fStatus.insert(fStatus.end(), other.fStatus.begin(), other.fStatus.end());
+    for (int i = 0; i < other.fNscan; i++) fSource.push_back(other.fSource[i] + nfile);
+    fFiles.insert(fFiles.end(), other.fFiles.begin(), other.fFiles.end());
+    fNscan += other.fNscan;
+    return true;
+  }
+
+  // Append scan iscan of other as coming from file ifile of this store (the caller keeps the file names
+  // with SetFileNames). Same grid rule as Append().
+  bool AppendScan(const CrystalSpectra& other, int iscan, int ifile)
+  {
+    if (fNscan == 0 && fFiles.empty()) {
+      fNwl = other.fNwl;
+      fWL  = other.fWL;
+    }
+    else if (!SameGrid(other)) return false;
+    fLT.insert(fLT.end(), other.Row(iscan), other.Row(iscan) + fNwl);
+    fCrystal.push_back(other.fCrystal[iscan]);
+    fStatus.push_back(other.fStatus[iscan]);
+    fSource.push_back(ifile);
+    fNscan++;
+    return true;
+  }
+
+  // Heap memory held by the spectra
+  size_t Bytes() const
+  {
+    return (fWL.size() + fLT.size()) * sizeof(double) + (fCrystal.size() + fStatus.size() + fSource.size()) * sizeof(int);
+  }
+
+private:
+  int                      fNscan;
+  int                      fNwl;
+  std::vector<double>      fWL;        // wavelength (nm) per row
+  std::vector<double>      fLT;        // fNscan rows of fNwl LT values
+  std::vector<int>         fCrystal;   // crystal number per scan
+  std::vector<int>         fStatus;    // ECrystalStatus
+  std::vector<int>         fSource;    // index in fFiles per scan
+  std::vector<std::string> fFiles;
+};
+
+#endif
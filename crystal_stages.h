@@ -0,0 +1,136 @@
+// crystal_stages.h - Per-stage instrumentation of a reader run: wall time, bytes and items per stage.
+//
+// Stages follow the data through crystal_dataReader.cc: open (map the csv files), header (trace
+// names), body (LT values), pairing (bef/irr pairs), compute (deltaK and bands) and write (output
+// tree). Each stage accumulates over calls, e.g. once per file for the read stages; files read in
+// parallel add their own times, so those stages can exceed the wall time of the run.
+//
+// WriteJSON() dumps the table as one JSON object for scripts and regression tracking:
+//   {"wall_seconds": 1.23, "stages": [{"stage": "open", "seconds": ..., "bytes": ..., "items": ..., "calls": ...}, ...]}
+
+#ifndef CRYSTAL_STAGES_H
+#define CRYSTAL_STAGES_H
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+
+// Seconds on a monotonic clock, for differences
+inline double crystalNow()
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+enum ECrystalStage {
+  kStageOpen    = 0,
+  kStageHeader  = 1,
+  kStageBody    = 2,
+  kStagePairing = 3,
+  kStageCompute = 4,
+  kStageWrite   = 5,
+  kNStage       = 6
+};
+
+inline const char* crystalStageName(int stage)
+{
+  static const char* names[kNStage] = { "open", "header", "body", "pairing", "compute", "write" };
+  return stage >= 0 && stage < kNStage ? names[stage] : "unknown";
+}
+
+struct CrystalStageStats {
+  double seconds;
+  double bytes;
+  double items;
+  long   calls;
+
+  CrystalStageStats() : seconds(0), bytes(0), items(0), calls(0) {}
+};
+
+
+class CrystalStageTimer {
+public:
+  CrystalStageTimer() : fStart(crystalNow()) {}
+
+  void Add(int stage, double seconds, double bytes = 0, double items = 0)
+  {
+    if (stage < 0 || stage >= kNStage) return;
+    std::lock_guard<std::mutex> lock(fMutex);
+    fStats[stage].seconds += seconds;
+    fStats[stage].bytes   += bytes;
+    fStats[stage].items   += items;
+    fStats[stage].calls++;
+  }
+
+  const CrystalStageStats& Get(int stage) const { return fStats[stage]; }
+  double WallSeconds() const { return crystalNow() - fStart; }
+
+  // Human readable table, one line per stage that ran
+  std::string Format() const
+  {
+    std::string text;
+    char line[160];
+    for (int s = 0; s < kNStage; s++) {
+      const CrystalStageStats& st = fStats[s];
+      if (st.calls == 0) continue;
+      std::snprintf(line, sizeof(line), "  %-8s %10.3f ms %10.2f MB %12.0f items", crystalStageName(s),
+                    1e3 * st.seconds, st.bytes / 1e6, st.items);
+      text += line;
+      if (st.seconds > 0 && st.bytes > 0) {
+        std::snprintf(line, sizeof(line), " %10.1f MB/s", st.bytes / 1e6 / st.seconds);
+        text += line;
+      }
+      text += '\n';
+    }
+    std::snprintf(line, sizeof(line), "  %-8s %10.3f ms", "wall", 1e3 * WallSeconds());
+    return text + line;
+  }
+
+  // Machine readable summary; path "-" writes to stdout. Returns false if the file cannot be written.
+  bool WriteJSON(const std::string& path) const
+  {
+    FILE* f = path == "-" ? stdout : std::fopen(path.c_str(), "w");
+    if (!f) return false;
+    std::fprintf(f, "{\"wall_seconds\": %.6f, \"stages\": [", WallSeconds());
+    for (int s = 0; s < kNStage; s++) {
+      const CrystalStageStats& st = fStats[s];
+      std::fprintf(f, "%s\n  {\"stage\": \"%s\", \"seconds\": %.6f, \"bytes\": %.0f, \"items\": %.0f, \"calls\": %ld}",
+                   s ? "," : "", crystalStageName(s), st.seconds, st.bytes, st.items, st.calls);
+    }
+    std::fprintf(f, "\n]}\n");
+    return path == "-" ? std::fflush(f) == 0 : std::fclose(f) == 0;
+  }
+
+private:
+  CrystalStageTimer(const CrystalStageTimer&);
+  CrystalStageTimer& operator=(const CrystalStageTimer&);
+
+  double            fStart;
+  CrystalStageStats fStats[kNStage];
+  std::mutex        fMutex;
+};
+
+
+// Times one stage from construction to destruction; bytes and items can be set on the way
+class CrystalStageScope {
+public:
+  CrystalStageScope(CrystalStageTimer& timer, int stage) : fTimer(timer), fStage(stage), fStart(crystalNow()), fBytes(0), fItems(0) {}
+  ~CrystalStageScope() { fTimer.Add(fStage, crystalNow() - fStart, fBytes, fItems); }
+
+  void SetBytes(double bytes) { fBytes = bytes; }
+  void SetItems(double items) { fItems = items; }
+
+private:
+  CrystalStageScope(const CrystalStageScope&);
+  CrystalStageScope& operator=(const CrystalStageScope&);
+
+  CrystalStageTimer& fTimer;
+  int                fStage;
+  double             fStart;
+  double             fBytes;
+  double             fItems;
+};
+
+#endif
@@ -0,0 +1,314 @@
+// crystal_stream.h - Bounded-memory reader for Giessen LT files too wide to hold in memory.
+//
+// The csv file has one row per wavelength and one column per scan, so no scan is complete before the
+// last row has been read. CrystalStreamReader reads the text in fixed-size chunks and parses a block
+// of rows at a time into a scan-major buffer (the transpose). While the whole file fits the memory
+// budget that buffer is all there is; once it fills, each row block is spilled to an unlinked
+// temporary file as nscan runs of rows. Scans are then handed out in column blocks: a block of scans
+// is gathered from the row blocks with one scatter read per row block.
+//
+// Peak memory is about CrystalStreamConfig::memoryBytes (half for the row block, half for the column
+// block) plus the read buffer and one line, whatever the number of scans in the file.
+
+#ifndef CRYSTAL_STREAM_H
+#define CRYSTAL_STREAM_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "crystal_csvReader.h"
+#include "crystal_spectra.h"
+
+
+struct CrystalStreamConfig {
+  size_t      memoryBytes;   // budget for the row and column blocks
+  size_t      readBytes;     // size of each read() from the csv file
+  std::string tmpDir;        // where the spill file goes; empty == $TMPDIR or /tmp
+
+  CrystalStreamConfig(size_t memory = 64 << 20) : memoryBytes(memory), readBytes(1 << 20) {}
+};
+
+
+// Line-at-a-time reader over read() chunks; a line longer than the buffer grows it.
+class CrystalLineReader {
+public:
+  CrystalLineReader(int fd, size_t chunk) : fFd(fd), fBuf(chunk > 0 ? chunk : 4096), fPos(0), fEnd(0), fEOF(false), fError(false), fBytes(0) {}
+
+  // Next line in [begin, end), without the '\n'. Returns false at end of file or on a read error.
+  bool Next(const char*& begin, const char*& end)
+  {
+    for (;;) {
+      const char* p = fBuf.data() + fPos;
+      const char* nl = static_cast<const char*>(std::memchr(p, '\n', fEnd - fPos));
+      if (nl || (fEOF && fPos < fEnd)) {
+        begin = p;
+        end = nl ? nl : fBuf.data() + fEnd;
+        fPos = nl ? nl + 1 - fBuf.data() : fEnd;
+        return true;
+      }
+      if (fEOF) return false;
+      // keep the partial line, make room and read more
+      std::memmove(fBuf.data(), p, fEnd - fPos);
+      fEnd -= fPos;
+      fPos = 0;
+      if (fEnd == fBuf.size()) fBuf.resize(2 * fBuf.size());
+      ssize_t n;
+      do n = ::read(fFd, fBuf.data() + fEnd, fBuf.size() - fEnd); while (n < 0 && errno == EINTR);
+      if (n < 0) fError = true;
+      if (n <= 0) fEOF = true;
+      else { fEnd += n; fBytes += n; }
+    }
+  }
+
+  bool   Error() const { return fError; }
+  size_t Bytes() const { return fBytes; }
+
+private:
+  int               fFd;
+  std::vector<char> fBuf;
+  size_t            fPos;
+  size_t            fEnd;
+  bool              fEOF;
+  bool              fError;
+  size_t            fBytes;
+};
+
+
+class CrystalStreamReader {
+public:
+  explicit CrystalStreamReader(const CrystalStreamConfig& config = CrystalStreamConfig())
+    : fConfig(config), fBlockRows(0), fRows(0), fSpill(-1), fSpillBytes(0) {}
+
+  ~CrystalStreamReader() { Reset(); }
+
+  // Read the header and all data rows of path, spilling row blocks when they do not fit the budget.
+  // Returns false if the file cannot be opened or read, or the spill file cannot be written.
+  bool Open(const char* path)
+  {
+    Reset();
+    fFileName = path;
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) return false;
+    CrystalLineReader lines(fd, fConfig.readBytes);
+
+    // header: count line and trace names (parseGiessenHeader wants both lines in one range)
+    const char *b1, *e1, *b2, *e2;
+    std::string header;
+    if (lines.Next(b1, e1)) {
+      header.assign(b1, e1);
+      header += '\n';
+      if (lines.Next(b2, e2)) header.append(b2, e2);
+    }
+    std::vector<std::pair<int, int> > names;
+    parseGiessenHeader(header.data(), header.data() + header.size(), fInfo, names);
+    fNames.swap(names);
+    const int nscan = fInfo.nscan;
+
+    // rows per block so that a block of all scans fits half the budget
+    const size_t rowBytes = (size_t)(nscan > 0 ? nscan : 1) * sizeof(double);
+    fBlockRows = fConfig.memoryBytes / 2 / rowBytes;
+    if (fBlockRows < 1) fBlockRows = 1;
+    fBlock.assign((size_t)nscan * fBlockRows, 0.);
+
+    bool ok = true;
+    const char *b, *e;
+    for (int line = 3; ok && lines.Next(b, e); line++) {
+      // a full block is spilled only when one more row comes, so a file of exactly fBlockRows rows
+      // (trailing blank lines included) stays in memory
+      if (fRows == (int)fBlockRows) {
+        const char* q = b;
+        while (q != e && crystalIsSeparator(*q)) q++;
+        if (q == e) continue;
+        ok = FlushBlock();
+        if (!ok) break;
+      }
+      double wl = 0;
+      const int row = fRows;
+      double* lt = fBlock.data() + row;
+      const size_t stride = fBlockRows;
+      auto sink = [=](int iscan, double v) { lt[iscan * stride] = v; };
+      const int ntoken = parseGiessenRow(b, e, nscan, wl, fInfo.nbad, sink, &fInfo.diagnostics, line);
+      // the block is reused: a short row must not keep the LT of an earlier block
+      crystalCheckRow(ntoken, nscan, line, fInfo.diagnostics, sink);
+      if (ntoken == 0) continue;
+      fWL.push_back(wl);
+      fRows++;
+    }
+    ok = ok && !lines.Error();
+    if (ok && fSpill >= 0 && fRows > 0) ok = FlushBlock();   // last, partial block
+    ::close(fd);
+    fInfo.nrow = fWL.size();
+    fInfo.nbytes = lines.Bytes();
+
+    // not spilled: the one block holds every row; compact it in place to nrow values per scan. The
+    // capacity is kept (it is within the budget): shrinking would copy and briefly hold both.
+    if (ok && fSpill < 0 && fRows < (int)fBlockRows) {
+      for (int i = 1; i < nscan; i++)
+        std::memmove(&fBlock[(size_t)i * fRows], &fBlock[(size_t)i * fBlockRows], fRows * sizeof(double));
+      fBlock.resize((size_t)nscan * fRows);
+    }
+    if (!ok) Reset();
+    return ok;
+  }
+
+  const CrystalCSVInfo& Info()        const { return fInfo; }
+  const std::string&    FileName()    const { return fFileName; }
+  int                   NScans()      const { return fInfo.nscan; }
+  int                   NWavelengths() const { return fWL.size(); }
+  const double*         WL()          const { return fWL.empty() ? 0 : &fWL[0]; }
+  int                   Crystal(int iscan) const { return fNames[iscan].first; }
+  int                   Status(int iscan)  const { return fNames[iscan].second; }
+  bool                  Spilled()     const { return fSpill >= 0; }
+  size_t                SpillBytes()  const { return fSpillBytes; }
+
+  // Scans per column block within the budget
+  int BlockScans() const
+  {
+    size_t n = fConfig.memoryBytes / 2 / ((fWL.empty() ? 1 : fWL.size()) * sizeof(double));
+    return n < 1 ? 1 : (n > (size_t)INT_MAX ? INT_MAX : (int)n);
+  }
+
+  // Load scans [first, first + n) into block (resized to n scans on the file's grid)
+  bool ReadBlock(int first, int n, CrystalSpectra& block) const
+  {
+    const int nwl = fWL.size();
+    block.Resize(n, nwl);
+    block.SetFileName(fFileName);
+    if (nwl > 0) std::memcpy(block.WL(), &fWL[0], nwl * sizeof(double));
+    for (int i = 0; i < n; i++) block.SetScan(i, Crystal(first + i), Status(first + i));
+    if (n == 0 || nwl == 0) return true;
+
+    if (fSpill < 0) {
+      std::memcpy(block[0], &fBlock[(size_t)first * nwl], (size_t)n * nwl * sizeof(double));
+      return true;
+    }
+    // row block k holds rows [row0, row0 + nrow) of every scan, scan-major: one scatter read per block
+    std::vector<struct iovec> iov(n < IOV_MAX ? n : IOV_MAX);
+    int row0 = 0;
+    for (size_t k = 0; k < fSpillRows.size(); k++) {
+      const int nrow = fSpillRows[k];
+      const size_t runBytes = (size_t)nrow * sizeof(double);
+      for (int i = 0; i < n; i += iov.size()) {
+        const int m = n - i < (int)iov.size() ? n - i : iov.size();
+        for (int j = 0; j < m; j++) {
+          iov[j].iov_base = block[i + j] + row0;
+          iov[j].iov_len  = runBytes;
+        }
+        if (!ReadAll(&iov[0], m, fSpillOffset[k] + (off_t)(first + i) * runBytes, m * runBytes)) return false;
+      }
+      row0 += nrow;
+    }
+    return true;
+  }
+
+  // Call func(block) for consecutive column blocks of at most BlockScans() scans; block scan i is
+  // scan first + i of the file. Stops and returns false on a read error.
+  bool ForEachBlock(const std::function<void(int first, const CrystalSpectra& block)>& func) const
+  {
+    CrystalSpectra block;
+    const int nblock = BlockScans();
+    for (int first = 0; first < NScans(); first += nblock) {
+      const int n = NScans() - first < nblock ? NScans() - first : nblock;
+      if (!ReadBlock(first, n, block)) return false;
+      func(first, block);
+    }
+    return true;
+  }
+
+private:
+  CrystalStreamReader(const CrystalStreamReader&);
+  CrystalStreamReader& operator=(const CrystalStreamReader&);
+
+  void Reset()
+  {
+    if (fSpill >= 0) ::close(fSpill);
+    fSpill = -1;
+    fSpillBytes = 0;
+    fSpillRows.clear();
+    fSpillOffset.clear();
+    fInfo = CrystalCSVInfo();
+    fNames.clear();
+    fWL.clear();
+    std::vector<double>().swap(fBlock);
+    fRows = 0;
+  }
+
+  // Append the fRows rows of the current block to the spill file, as nscan runs of fRows values
+  bool FlushBlock()
+  {
+    if (fSpill < 0) {
+      std::string dir = fConfig.tmpDir;
+      if (dir.empty()) dir = std::getenv("TMPDIR") ? std::getenv("TMPDIR") : "/tmp";
+      std::string name = dir + "/crystal_stream_XXXXXX";
+      fSpill = ::mkstemp(&name[0]);
+      if (fSpill < 0) return false;
+      ::unlink(name.c_str());   // removed by the system when closed, even after a crash
+    }
+    const int nscan = fInfo.nscan;
+    if (fRows < (int)fBlockRows)
+      for (int i = 1; i < nscan; i++)
+        std::memmove(&fBlock[(size_t)i * fRows], &fBlock[(size_t)i * fBlockRows], fRows * sizeof(double));
+    const size_t bytes = (size_t)nscan * fRows * sizeof(double);
+    const char* p = reinterpret_cast<const char*>(fBlock.data());
+    for (size_t done = 0; done < bytes;) {
+      ssize_t n = ::pwrite(fSpill, p + done, bytes - done, fSpillBytes + done);
+      if (n < 0 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      done += n;
+    }
+    fSpillOffset.push_back(fSpillBytes);
+    fSpillRows.push_back(fRows);
+    fSpillBytes += bytes;
+    fRows = 0;
+    std::fill(fBlock.begin(), fBlock.end(), 0.);
+    return true;
+  }
+
+  bool ReadAll(struct iovec* iov, int n, off_t offset, size_t bytes) const
+  {
+    ssize_t got;
+    do got = ::preadv(fSpill, iov, n, offset); while (got < 0 && errno == EINTR);
+    if (got == (ssize_t)bytes) return true;
+    if (got < 0) return false;
+    // short read: finish vector by vector
+    for (int j = 0; j < n; j++) {
+      char* p = static_cast<char*>(iov[j].iov_base);
+      size_t len = iov[j].iov_len;
+      if ((size_t)got >= len) { got -= len; offset += len; continue; }
+      p += got; len -= got; offset += got; got = 0;
+      while (len > 0) {
+        ssize_t m = ::pread(fSpill, p, len, offset);
+        if (m < 0 && errno == EINTR) continue;
+        if (m <= 0) return false;
+        p += m; len -= m; offset += m;
+      }
+    }
+    return true;
+  }
+
+  CrystalStreamConfig               fConfig;
+  std::string                       fFileName;
+  CrystalCSVInfo                    fInfo;
+  std::vector<std::pair<int, int> > fNames;        // (crystal, status) per scan
+  std::vector<double>               fWL;
+  std::vector<double>               fBlock;        // scan-major row block, fBlockRows values per scan
+  size_t                            fBlockRows;
+  int                               fRows;         // rows in fBlock
+  int                               fSpill;        // spill file descriptor, -1 while everything fits
+  off_t                             fSpillBytes;
+  std::vector<off_t>                fSpillOffset;  // per spilled row block
+  std::vector<int>                  fSpillRows;
+};
+
+#endif
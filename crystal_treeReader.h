@@ -0,0 +1,91 @@
+// crystal_treeReader.h - Loads the "crystals" tree of crystal_treeWriter.h back into a CrystalSpectra store.
+//
+// For re-analysing archived campaigns without the csv files. Only the crystal, status, source and LT
+// branches are read; the LT branch is pointed at the row of the store for each entry, so ROOT decodes
+// the baskets - double, float or fixed point (CrystalTreeConfig::storage) - straight into the
+// analysis buffer, without an intermediate copy. NaN cells stored in fixed point are restored
+// (crystalDecodeLT).
+
+#ifndef CRYSTAL_TREEREADER_H
+#define CRYSTAL_TREEREADER_H
+
+#include <TBranch.h>
+#include <TFile.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TObjString.h>
+#include <TTree.h>
+#include <TVectorD.h>
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "crystal_spectra.h"
+#include "crystal_treeWriter.h"
+
+
+// Read every scan of fileName into spectra; corrected selects lt_corr instead of lt. Returns false if
+// the file, the tree, the grid or the LT branch is missing, or the branch does not match the grid.
+inline bool readCrystalTree(const std::string& fileName, CrystalSpectra& spectra, bool corrected = false)
+{
+  TFile* file = TFile::Open(fileName.c_str(), "READ");
+  if (!file || file->IsZombie()) {
+    delete file;
+    return false;
+  }
+  TVectorD* wavelength = dynamic_cast<TVectorD*>(file->Get("wavelength"));
+  TTree* tree = dynamic_cast<TTree*>(file->Get("crystals"));
+  const char* ltName = corrected ? "lt_corr" : "lt";
+  TLeaf* leaf = tree ? tree->GetLeaf(ltName) : 0;
+  // both storage modes of the compact trees are Double32_t, read as double
+  const bool ok = wavelength && leaf && leaf->GetLen() == wavelength->GetNrows() &&
+                  (std::strcmp(leaf->GetTypeName(), "Double_t") == 0 || std::strcmp(leaf->GetTypeName(), "Double32_t") == 0);
+  if (!ok) {
+    delete wavelength;
+    delete file;
+    return false;
+  }
+
+  const int nwl = wavelength->GetNrows();
+  const Long64_t nscan = tree->GetEntries();
+  spectra.Resize(nscan, nwl);
+  std::memcpy(spectra.WL(), wavelength->GetMatrixArray(), nwl * sizeof(double));
+  delete wavelength;
+
+  std::vector<std::string> names;
+  TObjArray* sources = dynamic_cast<TObjArray*>(file->Get("sources"));
+  for (int i = 0; sources && i < sources->GetEntries(); i++) {
+    TObjString* name = dynamic_cast<TObjString*>(sources->At(i));
+    names.push_back(name ? name->GetString().Data() : "");
+  }
+  delete sources;
+  spectra.SetFileNames(names);
+
+  Int_t crystal = -1, status = -1, source = 0;
+  tree->SetBranchStatus("*", 0);
+  tree->SetBranchStatus("crystal", 1);
+  tree->SetBranchStatus("status", 1);
+  tree->SetBranchStatus("source", 1);
+  tree->SetBranchStatus(ltName, 1);
+  tree->SetBranchAddress("crystal", &crystal);
+  tree->SetBranchAddress("status", &status);
+  tree->SetBranchAddress("source", &source);
+  TBranch* lt = tree->GetBranch(ltName);
+  CrystalTreeConfig storage;
+  crystalParseLeafStorage(lt->GetTitle(), storage);
+  for (Long64_t i = 0; i < nscan; i++) {
+    lt->SetAddress(spectra[i]);
+    tree->GetEntry(i);
+    crystalDecodeLT(storage, spectra[i], nwl);   // fixed point: the reserved top code back to NaN
+    spectra.SetScan(i, crystal, status);
+    spectra.SetSource(i, source >= 0 && source < (int)names.size() ? source : 0);
+  }
+  tree->ResetBranchAddresses();
+
+  file->Close();
+  delete file;   // owns the tree
+  return true;
+}
+
+#endif
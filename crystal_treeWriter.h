@@ -0,0 +1,386 @@
+// crystal_treeWriter.h - Output stage of crystal_dataReader.cc: one TTree entry per Giessen LT scan.
+//
+// Tree "crystals":
+//   scan       /I   entry number
+//   source     /I   index of the csv file the scan was read from, in the TObjArray "sources"
+//   crystal    /I   crystal number (from the PbWO_NNN_abc trace name)
+//   status     /I   ECrystalStatus: 0 == bef, 1 == irr, 2 == ann, -1 == unknown
+//   lt[nwl]    /D   light transmission (%) at each wavelength of the file (or a compact type, below)
+//   lt_corr[nwl] /D baseline/scale corrected LT (crystal_correction.h), only with CrystalTreeConfig::corrected;
+//                   the gain and bias applied are stored as the TVectorD "correction_gain" / "correction_bias"
+// The wavelength grid is common to all scans and is stored once, as the TVectorD "wavelength".
+//
+// With CrystalTreeConfig::append the scans are added to the "crystals" tree already in the file
+// (incremental runs, crystal_manifest.h): the existing entries and baskets are left as they are, the
+// new entries continue the scan numbering and "sources" is rewritten with the full list of files.
+// The derived trees (pairs, quality, fits) are rewritten in full by every incremental run, and a
+// replaced tree leaves its baskets behind as dead space; crystalCompactFile() copies the live objects
+// to a fresh file once the dead space exceeds the live size, so the output stays within about twice
+// the size a full run would write.
+//
+// Compression algorithm/level and basket size are set per output file, so the archive can trade
+// file size against read speed: algorithm 1 = zlib, 2 = lzma, 4 = lz4, 5 = zstd; level 0-9.
+//
+// The LT values can be stored with less precision than double (CrystalTreeConfig::storage). Both
+// compact modes are Double32_t leaves, so they are still read into double buffers and decoded by
+// ROOT straight into them (crystal_treeReader.h):
+//   kStorageDouble   /D                    64 bits, exact
+//   kStorageFloat    /d                    32 bits, relative error <= 2^-24 (6e-8)
+//   kStorageFixed    /d[min,max,bits]      fixed point, absolute error <= (max - min) / 2^(bits + 1);
+//                                          values outside [min, max - step] are clamped, step = (max - min)
+//                                          / 2^bits. The default 16 bits on [-10, 110] % gives 0.0009 % LT,
+//                                          far below the spectrometer noise.
+// NaN (unreadable or missing cells, crystal_csvReader.h) is kept by double and float. Fixed point has
+// no code for it (ROOT's clamping lets NaN through to an undefined integer conversion), so the top
+// code, max, is reserved: NaN is written as max (crystalEncodeLT) and every value decoded at or above
+// max - step / 2 is read back as NaN (crystalDecodeLT, done by crystal_treeReader.h and
+// crystal_analysis.cc; the leaf title carries the range).
+
+#ifndef CRYSTAL_TREEWRITER_H
+#define CRYSTAL_TREEWRITER_H
+
+#include <TFile.h>
+#include <TKey.h>
+#include <TLeaf.h>
+#include <TObjArray.h>
+#include <TObjString.h>
+#include <TTree.h>
+#include <TString.h>
+#include <TVectorD.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+enum ECrystalStorage {
+  kStorageDouble = 0,
+  kStorageFloat  = 1,
+  kStorageFixed  = 2
+};
+
+struct CrystalTreeConfig {
+  std::string fileName;
+  int         compressionAlgorithm;
+  int         compressionLevel;
+  int         basketSize;            // bytes per branch basket
+  bool        corrected;             // also write the corrected spectra, lt_corr
+  int         storage;               // ECrystalStorage of the LT values
+  double      fixedMin;              // kStorageFixed: range (%) and bits per value (2-32)
+  double      fixedMax;
+  int         fixedBits;
+  bool        append;                // add to the crystals tree of an existing file instead of recreating it
+
+  CrystalTreeConfig(const char* name = "crystal_LT.root")
+    : fileName(name), compressionAlgorithm(5), compressionLevel(5), basketSize(32000), corrected(false),
+      storage(kStorageDouble), fixedMin(-10), fixedMax(110), fixedBits(16), append(false) {}
+
+  // Leaf type of the LT arrays: "D", "d" or "d[min,max,bits]"
+  std::string LeafType() const
+  {
+    if (storage == kStorageFloat) return "d";
+    if (storage == kStorageFixed) return Form("d[%g,%g,%d]", fixedMin, fixedMax, fixedBits);
+    return "D";
+  }
+
+  // Fixed point: spacing of the codes (% LT)
+  double FixedStep() const { return (fixedMax - fixedMin) / std::ldexp(1., fixedBits); }
+
+  // Largest storage error: absolute (% LT) for fixed point, relative for float, 0 for double.
+  // NaN is stored exactly in every mode (in fixed point as the reserved top code).
+  double StorageError() const
+  {
+    if (storage == kStorageFloat) return std::ldexp(1., -24);
+    if (storage == kStorageFixed) return (fixedMax - fixedMin) / std::ldexp(1., fixedBits + 1);
+    return 0;
+  }
+};
+
+// Storage mode from "double", "float", "fixed" or "fixed:BITS[:MIN:MAX]", e.g. "fixed:12:0:100".
+// Returns false for anything else.
+inline bool crystalParseStorage(const char* text, CrystalTreeConfig& config)
+{
+  if (std::strcmp(text, "double") == 0) { config.storage = kStorageDouble; return true; }
+  if (std::strcmp(text, "float") == 0)  { config.storage = kStorageFloat;  return true; }
+  if (std::strncmp(text, "fixed", 5) != 0) return false;
+  const char* p = text + 5;
+  if (*p == 0) { config.storage = kStorageFixed; return true; }
+  char* stop;
+  const int bits = std::strtol(p + 1, &stop, 10);
+  if (*p != ':' || stop == p + 1 || bits < 2 || bits > 32) return false;
+  double lo = config.fixedMin, hi = config.fixedMax;
+  if (*stop == ':') {
+    p = stop + 1;
+    lo = std::strtod(p, &stop);
+    if (stop == p || *stop != ':') return false;
+    p = stop + 1;
+    hi = std::strtod(p, &stop);
+    if (stop == p || !(hi > lo)) return false;
+  }
+  if (*stop) return false;
+  config.storage   = kStorageFixed;
+  config.fixedBits = bits;
+  config.fixedMin  = lo;
+  config.fixedMax  = hi;
+  return true;
+}
+
+
+// Storage mode of a leaf from its branch title, "lt[1151]/D", "lt[1151]/d" or "lt[1151]/d[-10,110,16]".
+// Returns false if the title has no leaf type.
+inline bool crystalParseLeafStorage(const char* title, CrystalTreeConfig& config)
+{
+  const char* slash = std::strrchr(title, '/');
+  if (!slash) return false;
+  if (std::strcmp(slash, "/D") == 0) { config.storage = kStorageDouble; return true; }
+  if (std::strcmp(slash, "/d") == 0) { config.storage = kStorageFloat;  return true; }
+  double lo, hi;
+  int bits;
+  if (std::sscanf(slash, "/d[%lf,%lf,%d]", &lo, &hi, &bits) != 3) return false;
+  config.storage   = kStorageFixed;
+  config.fixedMin  = lo;
+  config.fixedMax  = hi;
+  config.fixedBits = bits;
+  return true;
+}
+
+// Prepare n LT values in a branch buffer for writing: with fixed point, NaN becomes the reserved top
+// code and values that would round to it are clamped one step below. Nothing to do for double/float.
+inline void crystalEncodeLT(const CrystalTreeConfig& config, double* lt, int n)
+{
+  if (config.storage != kStorageFixed) return;
+  const double top = config.fixedMax - config.FixedStep();
+  for (int i = 0; i < n; i++) {
+    if (std::isnan(lt[i])) lt[i] = config.fixedMax;
+    else if (lt[i] > top) lt[i] = top;
+  }
+}
+
+// Undo crystalEncodeLT on n values read back from a leaf of this storage mode
+inline void crystalDecodeLT(const CrystalTreeConfig& config, double* lt, int n)
+{
+  if (config.storage != kStorageFixed) return;
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  const double top = config.fixedMax - config.FixedStep() / 2;
+  for (int i = 0; i < n; i++)
+    if (lt[i] >= top) lt[i] = nan;
+}
+
+
+class CrystalTreeWriter {
+public:
+  CrystalTreeWriter(const CrystalTreeConfig& config, const double* wl, int nwl,
+                    const std::vector<std::string>& sources = std::vector<std::string>())
+    : fConfig(config), fFile(0), fTree(0), fEntries(0), fBytesWritten(0), fScan(0), fSource(0), fCrystal(0), fStatus(0), fNwl(nwl > 0 ? nwl : 0),
+      fLT(nwl > 0 ? nwl : 1, 0.)
+  {
+    if (config.append) {
+      Reopen(config, nwl, sources);
+      return;
+    }
+    fFile = TFile::Open(config.fileName.c_str(), "RECREATE", "Giessen crystal LT data",
+                        config.compressionAlgorithm * 100 + config.compressionLevel);
+    if (!fFile || fFile->IsZombie()) {
+      delete fFile;
+      fFile = 0;
+      return;
+    }
+
+    TVectorD wavelength(nwl);
+    for (int i = 0; i < nwl; i++) wavelength[i] = wl[i];
+    wavelength.Write("wavelength");
+    TObjArray names;
+    names.SetOwner(kTRUE);
+    for (size_t i = 0; i < sources.size(); i++) names.Add(new TObjString(sources[i].c_str()));
+    names.Write("sources", TObject::kSingleKey);
+
+    fTree = new TTree("crystals", "Giessen LT scans");
+    fTree->Branch("scan",    &fScan,    "scan/I",    config.basketSize);
+    fTree->Branch("source",  &fSource,  "source/I",  config.basketSize);
+    fTree->Branch("crystal", &fCrystal, "crystal/I", config.basketSize);
+    fTree->Branch("status",  &fStatus,  "status/I",  config.basketSize);
+    const std::string leaf = config.LeafType();
+    fTree->Branch("lt",      &fLT[0],   Form("lt[%d]/%s", (int)fLT.size(), leaf.c_str()), config.basketSize);
+    if (config.corrected) {
+      fLTCorr.assign(fLT.size(), 0.);
+      fTree->Branch("lt_corr", &fLTCorr[0], Form("lt_corr[%d]/%s", (int)fLTCorr.size(), leaf.c_str()), config.basketSize);
+    }
+  }
+
+  // Store the correction applied to lt_corr, per wavelength: lt_corr = gain * lt + bias
+  void WriteCorrection(const double* gain, const double* bias, int nwl)
+  {
+    if (!fFile) return;
+    fFile->cd();
+    TVectorD g(nwl), b(nwl);
+    for (int i = 0; i < nwl; i++) { g[i] = gain[i]; b[i] = bias[i]; }
+    g.Write("correction_gain", TObject::kOverwrite);
+    b.Write("correction_bias", TObject::kOverwrite);
+  }
+
+  ~CrystalTreeWriter() { Close(); }
+
+  bool IsOpen() const { return fTree != 0; }
+
+  // Copy one scan into the branch buffers and fill; baskets are flushed to disk as they fill up.
+  // ltCorr is the corrected spectrum, used when the lt_corr branch exists.
+  void Fill(int crystal, int status, const double* lt, int source = 0, const double* ltCorr = 0)
+  {
+    if (!fTree) return;
+    fSource  = source;
+    fCrystal = crystal;
+    fStatus  = status;
+    if (fNwl > 0) std::memcpy(&fLT[0], lt, fNwl * sizeof(double));   // no rows: lt may be null
+    crystalEncodeLT(fConfig, &fLT[0], fLT.size());
+    if (!fLTCorr.empty() && ltCorr) {
+      if (fNwl > 0) std::memcpy(&fLTCorr[0], ltCorr, fNwl * sizeof(double));
+      crystalEncodeLT(fConfig, &fLTCorr[0], fLTCorr.size());
+    }
+    fTree->Fill();
+    fScan++;
+  }
+
+  Long64_t GetEntries() const { return fTree ? fTree->GetEntries() : fEntries; }
+
+  // Bytes written to the output file, known after Close()
+  Long64_t BytesWritten() const { return fBytesWritten; }
+
+  void Close()
+  {
+    if (!fFile) return;
+    fFile->cd();
+    if (fTree) {
+      fTree->Write("", TObject::kOverwrite);
+      fEntries = fTree->GetEntries();
+    }
+    fFile->Close();
+    fBytesWritten = fFile->GetBytesWritten();
+    delete fFile;
+    fFile = 0;
+    fTree = 0;   // owned by the file
+  }
+
+private:
+  // Append mode: open the file for update and point the branches of its crystals tree at the buffers.
+  // Fails (IsOpen() false) if there is no such tree or its LT arrays are not nwl long; lt_corr is
+  // filled only if the tree has it.
+  void Reopen(const CrystalTreeConfig& config, int nwl, const std::vector<std::string>& sources)
+  {
+    fFile = TFile::Open(config.fileName.c_str(), "UPDATE");
+    if (!fFile || fFile->IsZombie()) {
+      delete fFile;
+      fFile = 0;
+      return;
+    }
+    fTree = dynamic_cast<TTree*>(fFile->Get("crystals"));
+    TLeaf* lt = fTree ? fTree->GetLeaf("lt") : 0;
+    if (!lt || lt->GetLen() != nwl) {
+      fTree = 0;
+      return;   // the file is closed unchanged by Close()
+    }
+    crystalParseLeafStorage(fTree->GetBranch("lt")->GetTitle(), fConfig);   // encode as the tree was written
+    fScan = fTree->GetEntries();
+    fTree->SetBranchAddress("scan",    &fScan);
+    fTree->SetBranchAddress("source",  &fSource);
+    fTree->SetBranchAddress("crystal", &fCrystal);
+    fTree->SetBranchAddress("status",  &fStatus);
+    fTree->SetBranchAddress("lt",      &fLT[0]);
+    if (fTree->GetBranch("lt_corr")) {
+      fLTCorr.assign(fLT.size(), 0.);
+      fTree->SetBranchAddress("lt_corr", &fLTCorr[0]);
+    }
+    TObjArray names;
+    names.SetOwner(kTRUE);
+    for (size_t i = 0; i < sources.size(); i++) names.Add(new TObjString(sources[i].c_str()));
+    names.Write("sources", TObject::kSingleKey | TObject::kOverwrite);
+  }
+
+  CrystalTreeWriter(const CrystalTreeWriter&);
+  CrystalTreeWriter& operator=(const CrystalTreeWriter&);
+
+  CrystalTreeConfig     fConfig;   // storage mode of the LT branches (of the existing tree in append mode)
+  TFile*                fFile;
+  TTree*                fTree;
+  Long64_t              fEntries;
+  Long64_t              fBytesWritten;
+  Int_t                 fScan;
+  Int_t                 fSource;
+  Int_t                 fCrystal;
+  Int_t                 fStatus;
+  int                   fNwl;      // LT values per scan; the buffers hold at least one
+  std::vector<Double_t> fLT;
+  std::vector<Double_t> fLTCorr;
+};
+
+
+// Rewrite fileName without its dead space if that exceeds maxWaste times the live bytes (and 1 MB):
+// the latest cycle of every key is copied to "<fileName>.compact<pid>" (trees basket by basket,
+// without decompressing) and the copy is renamed over the original, so an interrupted compaction
+// leaves the file as it was. Returns the bytes saved, 0 if nothing was done, -1 on failure.
+inline Long64_t crystalCompactFile(const std::string& fileName, double maxWaste = 1.)
+{
+  TFile* in = TFile::Open(fileName.c_str(), "READ");
+  if (!in || in->IsZombie()) {
+    delete in;
+    return -1;
+  }
+  Long64_t live = 0;
+  TIter next(in->GetListOfKeys());
+  while (TKey* key = (TKey*)next()) {
+    if (key->GetCycle() != in->GetKey(key->GetName())->GetCycle()) continue;   // replaced
+    live += key->GetNbytes();
+    TTree* tree = dynamic_cast<TTree*>(key->ReadObj());
+    if (tree) live += tree->GetZipBytes();
+    delete tree;
+  }
+  const Long64_t size = in->GetSize();
+  if (size - live <= maxWaste * live || size - live <= (1 << 20)) {
+    in->Close();
+    delete in;
+    return 0;
+  }
+
+  const std::string tmp = fileName + ".compact" + std::to_string((long)::getpid());
+  TFile* out = TFile::Open(tmp.c_str(), "RECREATE", in->GetTitle(), in->GetCompressionSettings());
+  bool ok = out && !out->IsZombie();
+  next.Reset();
+  while (ok) {
+    TKey* key = (TKey*)next();
+    if (!key) break;
+    if (key->GetCycle() != in->GetKey(key->GetName())->GetCycle()) continue;
+    TObject* obj = key->ReadObj();
+    out->cd();
+    if (TTree* tree = dynamic_cast<TTree*>(obj)) {
+      TTree* copy = tree->CloneTree(-1, "fast");
+      ok = copy != 0;
+      if (ok) {
+        copy->SetDirectory(out);
+        ok = copy->Write("", TObject::kOverwrite) > 0;
+      }
+    }
+    else if (obj) ok = obj->Write(key->GetName(), TObject::kSingleKey) > 0;
+    delete obj;
+  }
+  in->Close();
+  delete in;
+  if (out) {
+    out->Close();
+    delete out;   // owns the copies
+  }
+  if (ok) ok = std::rename(tmp.c_str(), fileName.c_str()) == 0;
+  if (!ok) {
+    std::remove(tmp.c_str());
+    return -1;
+  }
+  struct stat st;
+  return ::stat(fileName.c_str(), &st) == 0 ? size - (Long64_t)st.st_size : 0;
+}
+
+#endif
@@ -0,0 +1,204 @@
+// crystal_wavelength.h - Wavelength lookup on the grid of a CrystalSpectra store, and band extraction.
+//
+// CrystalWavelengthIndex maps a wavelength (nm) to a fractional row of the grid: directly when the
+// grid is uniform (the Giessen files step by a constant 0.5 nm), by binary search otherwise.
+// Ascending and descending grids are both handled; values between rows are interpolated linearly.
+//
+// A CrystalBand is a point value, a band average or the integrated transmission over [lo, hi] nm.
+// Every band reduces to fixed weights on a few rows of the grid, so crystalExtractBands() builds
+// the weights once and then evaluates all bands for all spectra in one pass. A band that is not
+// fully inside the grid gives NaN rather than a value from the wrong rows.
+
+#ifndef CRYSTAL_WAVELENGTH_H
+#define CRYSTAL_WAVELENGTH_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <string>
+#include <vector>
+
+
+class CrystalWavelengthIndex {
+public:
+  CrystalWavelengthIndex() : fWL(0), fN(0), fOrder(0), fUniform(false), fStep(0) {}
+  CrystalWavelengthIndex(const double* wl, int n) { Build(wl, n); }
+
+  void Build(const double* wl, int n)
+  {
+    fWL = wl;
+    fN = n;
+    fOrder = 0;
+    fUniform = false;
+    fStep = 0;
+    if (n < 2) return;
+
+    // the grid must be strictly monotonic
+    const int order = wl[1] > wl[0] ? 1 : -1;
+    for (int i = 1; i < n; i++)
+      if (!(order * (wl[i] - wl[i - 1]) > 0)) return;
+    fOrder = order;
+
+    const double step = (wl[n - 1] - wl[0]) / (n - 1);
+    fUniform = true;
+    for (int i = 1; i < n && fUniform; i++)
+      if (std::fabs(wl[i] - (wl[0] + i * step)) > 1e-3 * std::fabs(step)) fUniform = false;
+    if (fUniform) fStep = step;
+  }
+
+  bool   IsValid()   const { return fOrder != 0; }
+  bool   IsUniform() const { return fUniform; }
+  int    Size()      const { return fN; }
+  double Min()       const { return fOrder > 0 ? fWL[0] : fWL[fN - 1]; }
+  double Max()       const { return fOrder > 0 ? fWL[fN - 1] : fWL[0]; }
+
+  // Row and interpolation fraction of lambda: wl(lambda) = (1-frac) * wl[row] + frac * wl[row+1].
+  // Returns false if lambda is outside the grid.
+  bool Locate(double lambda, int& row, double& frac) const
+  {
+    if (!IsValid() || !(lambda >= Min() && lambda <= Max())) return false;
+    if (fUniform) {
+      double x = (lambda - fWL[0]) / fStep;
+      row = (int)x;
+      if (row > fN - 2) row = fN - 2;
+      if (row < 0) row = 0;
+      frac = x - row;
+    }
+    else {
+      const double* hit = fOrder > 0 ? std::upper_bound(fWL, fWL + fN, lambda)
+                                     : std::upper_bound(fWL, fWL + fN, lambda, std::greater<double>());
+      row = (int)(hit - fWL) - 1;
+      if (row > fN - 2) row = fN - 2;
+      if (row < 0) row = 0;
+      frac = (lambda - fWL[row]) / (fWL[row + 1] - fWL[row]);
+    }
+    return true;
+  }
+
+  // Nearest row to lambda, -1 if outside the grid
+  int Nearest(double lambda) const
+  {
+    int row;
+    double frac;
+    if (!Locate(lambda, row, frac)) return -1;
+    return frac < 0.5 ? row : row + 1;
+  }
+
+  // Linear interpolation of a spectrum on this grid, NaN outside
+  double Interpolate(const double* spectrum, double lambda) const
+  {
+    int row;
+    double frac;
+    if (!Locate(lambda, row, frac)) return std::numeric_limits<double>::quiet_NaN();
+    return frac == 0 ? spectrum[row] : (1 - frac) * spectrum[row] + frac * spectrum[row + 1];
+  }
+
+  const double* Grid() const { return fWL; }
+
+private:
+  const double* fWL;       // not owned: the grid of the store
+  int           fN;
+  int           fOrder;    // +1 ascending, -1 descending, 0 not monotonic
+  bool          fUniform;
+  double        fStep;     // nm per row when uniform (negative for descending grids)
+};
+
+
+struct CrystalBand {
+  enum EKind { kPoint, kAverage, kIntegral };
+
+  std::string name;
+  int         kind;   // EKind
+  double      lo;     // nm
+  double      hi;     // nm, ignored for kPoint
+
+  CrystalBand(const std::string& n = "", int k = kPoint, double l = 0, double h = 0) : name(n), kind(k), lo(l), hi(h) {}
+};
+
+// The LT360, LT420 and LT620 quantities of the crystal acceptance tests
+inline std::vector<CrystalBand> crystalDefaultBands()
+{
+  std::vector<CrystalBand> bands;
+  bands.push_back(CrystalBand("LT360", CrystalBand::kPoint, 360));
+  bands.push_back(CrystalBand("LT420", CrystalBand::kPoint, 420));
+  bands.push_back(CrystalBand("LT620", CrystalBand::kPoint, 620));
+  return bands;
+}
+
+
+// Rows and weights such that band value = sum_k weight[k] * spectrum[row[k]]
+struct CrystalBandWeights {
+  std::vector<int>    row;
+  std::vector<double> weight;
+  bool                valid;
+};
+
+// Weights of one band: interpolation for points, exact integral of the piecewise linear spectrum
+// over [lo, hi] for integrals, the same divided by (hi - lo) for averages.
+inline CrystalBandWeights crystalBandWeights(const CrystalWavelengthIndex& index, const CrystalBand& band)
+{
+  CrystalBandWeights w;
+  w.valid = false;
+  int row;
+  double frac;
+  if (band.kind == CrystalBand::kPoint || band.hi == band.lo) {
+    if (!index.Locate(band.lo, row, frac)) return w;
+    if (frac < 1) { w.row.push_back(row);     w.weight.push_back(1 - frac); }
+    if (frac > 0) { w.row.push_back(row + 1); w.weight.push_back(frac); }
+    w.valid = true;
+    return w;
+  }
+
+  const double a = std::min(band.lo, band.hi), b = std::max(band.lo, band.hi);
+  int ra, rb;
+  double fa, fb;
+  if (!index.Locate(a, ra, fa) || !index.Locate(b, rb, fb)) return w;
+  const double* wl = index.Grid();
+  const int first = std::min(ra, rb), last = std::max(ra, rb);
+  std::vector<double> weight(last - first + 2, 0.);
+  for (int j = first; j <= last; j++) {
+    // overlap of segment [wl[j], wl[j+1]] with [a, b]
+    const double x0 = wl[j], x1 = wl[j + 1];
+    const double s0 = std::max(a, std::min(x0, x1)), s1 = std::min(b, std::max(x0, x1));
+    if (!(s1 > s0)) continue;
+    const double t0 = (s0 - x0) / (x1 - x0), t1 = (s1 - x0) / (x1 - x0);
+    const double len = s1 - s0;
+    weight[j - first]     += len * ((1 - t0) + (1 - t1)) / 2;
+    weight[j - first + 1] += len * (t0 + t1) / 2;
+  }
+  const double norm = band.kind == CrystalBand::kAverage ? 1. / (b - a) : 1.;
+  for (size_t k = 0; k < weight.size(); k++) {
+    if (weight[k] == 0) continue;
+    w.row.push_back(first + k);
+    w.weight.push_back(weight[k] * norm);
+  }
+  w.valid = true;
+  return w;
+}
+
+// Evaluate all bands for nspec spectra stored as contiguous rows of nwl values (a CrystalSpectra
+// store, or the deltaK table). out[ispec * bands.size() + iband]; NaN for bands outside the grid.
+inline void crystalExtractBands(const CrystalWavelengthIndex& index, const double* data, int nspec, int nwl,
+                                const std::vector<CrystalBand>& bands, std::vector<double>& out)
+{
+  const int nband = bands.size();
+  std::vector<CrystalBandWeights> weights(nband);
+  for (int ib = 0; ib < nband; ib++) weights[ib] = crystalBandWeights(index, bands[ib]);
+
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  out.assign((size_t)nspec * nband, nan);
+  for (int is = 0; is < nspec; is++) {
+    const double* spectrum = data + (size_t)is * nwl;
+    double* value = &out[(size_t)is * nband];
+    for (int ib = 0; ib < nband; ib++) {
+      const CrystalBandWeights& w = weights[ib];
+      if (!w.valid) continue;
+      double sum = 0;
+      for (size_t k = 0; k < w.row.size(); k++) sum += w.weight[k] * spectrum[w.row[k]];
+      value[ib] = sum;
+    }
+  }
+}
+
+#endif
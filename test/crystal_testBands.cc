@@ -0,0 +1,60 @@
+// crystal_testBands.cc - Wavelength bands (crystal_wavelength.h) on uniform and non-uniform grids.
+//
+// On a linear spectrum the interpolated point value, the band average and the trapezoid integral are
+// exact, on ascending and descending (Giessen order) grids alike; a band beyond the grid is NaN.
+// Exit code 0 if every case passes. ROOT-free:
+//
+//   make check
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "crystal_wavelength.h"
+
+
+static int testGrid(const char* name, const std::vector<double>& wl)
+{
+  const int nwl = wl.size();
+  std::vector<double> lt(2 * nwl);   // two spectra: 10 + 0.1 wl and 90 - 0.05 wl
+  for (int j = 0; j < nwl; j++) {
+    lt[j] = 10 + 0.1 * wl[j];
+    lt[nwl + j] = 90 - 0.05 * wl[j];
+  }
+  std::vector<CrystalBand> bands = crystalDefaultBands();
+  bands.push_back(CrystalBand("avg", CrystalBand::kAverage, 401.3, 455.9));
+  bands.push_back(CrystalBand("int", CrystalBand::kIntegral, 612.25, 350.5));   // reversed limits
+  bands.push_back(CrystalBand("out", CrystalBand::kPoint, 900));
+  const int nband = bands.size();
+
+  CrystalWavelengthIndex index(wl.data(), nwl);
+  std::vector<double> out;
+  crystalExtractBands(index, lt.data(), 2, nwl, bands, out);
+  bool ok = index.IsValid() && (int)out.size() == 2 * nband;
+  for (int is = 0; ok && is < 2; is++) {
+    const double a = is ? 90 : 10, b = is ? -0.05 : 0.1;
+    for (int ib = 0; ib < nband; ib++) {
+      const CrystalBand& band = bands[ib];
+      const double mid = (band.lo + band.hi) / 2;
+      double expect = a + b * (band.kind == CrystalBand::kPoint ? band.lo : mid);
+      if (band.kind == CrystalBand::kIntegral) expect *= std::fabs(band.hi - band.lo);
+      const double v = out[is * nband + ib];
+      ok = ok && (band.name == "out" ? std::isnan(v) : std::fabs(v - expect) <= 1e-9 * std::fabs(expect));
+    }
+  }
+  std::printf("%-36s %s\n", name, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main()
+{
+  std::vector<double> up, down, uneven;
+  for (int j = 0; j <= 600; j++) up.push_back(200 + j);
+  for (int j = 0; j <= 1200; j++) down.push_back(800 - 0.5 * j);
+  for (double w = 800; w >= 200; w -= 0.7 + 0.6 * std::fabs(std::sin(w))) uneven.push_back(w);
+  int nfail = 0;
+  nfail += testGrid("uniform ascending grid", up);
+  nfail += testGrid("uniform descending grid", down);
+  nfail += testGrid("non-uniform descending grid", uneven);
+  return nfail ? 1 : 0;
+}
@@ -0,0 +1,135 @@
+// crystal_testCSV.cc - Giessen csv parser (crystal_csvReader.h) on well-formed and malformed input.
+//
+// The same file with LF and CRLF line ends must give the same spectra; malformed cells, short and
+// long rows, bad trace counts and names must be stored as NaN / ignored and recorded with their line
+// and column; integers beyond INT_MAX must be rejected. Exit code 0 if every case passes. ROOT-free:
+//
+//   make check
+
+#include <climits>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "crystal_csvReader.h"
+#include "crystal_spectra.h"
+
+
+static int testResult(const char* name, bool ok)
+{
+  std::printf("%-40s %s\n", name, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+static void testParse(const std::string& text, CrystalCSVInfo& info, CrystalSpectra& spectra)
+{
+  parseGiessenCSV(text.data(), text.data() + text.size(), "test.csv", info, spectra);
+}
+
+// CRLF instead of LF everywhere
+static std::string testCRLF(const std::string& text)
+{
+  std::string out;
+  for (size_t i = 0; i < text.size(); i++) {
+    if (text[i] == '\n') out += '\r';
+    out += text[i];
+  }
+  return out;
+}
+
+// Diagnostic i of info has the given code, line and column
+static bool testDiag(const CrystalCSVInfo& info, int i, int code, int line, int column)
+{
+  if (i >= info.diagnostics.NStored()) return false;
+  const CrystalCSVDiagnostic& d = info.diagnostics.Get(i);
+  return d.code == code && d.line == line && d.column == column;
+}
+
+static int testLineEnds()
+{
+  const std::string text = "2\nPbWO_12_bef PbWO_12_irr\n800 71.5 800 70.25\n799.5 71 799.5 69.75\n\n";
+  CrystalCSVInfo lf, crlf;
+  CrystalSpectra a, b;
+  testParse(text, lf, a);
+  testParse(testCRLF(text), crlf, b);
+  bool ok = lf.nscanFile == 2 && lf.nscan == 2 && lf.nrow == 2 && lf.nbad == 0 && lf.diagnostics.Total() == 0;
+  ok = ok && crlf.nscanFile == 2 && crlf.nscan == 2 && crlf.nrow == 2 && crlf.nbad == 0 && crlf.diagnostics.Total() == 0;
+  ok = ok && a.Crystal(1) == 12 && a.Status(0) == kStatusBef && a.Status(1) == kStatusIrr;
+  ok = ok && b.Crystal(1) == 12 && b.Status(0) == kStatusBef && b.Status(1) == kStatusIrr;
+  ok = ok && a.WL()[1] == 799.5 && a[0][0] == 71.5 && a[1][1] == 69.75;
+  for (int i = 0; ok && i < 2; i++) {
+    ok = a.WL()[i] == b.WL()[i];
+    for (int s = 0; ok && s < 2; s++) ok = a[s][i] == b[s][i];
+  }
+  return testResult("LF and CRLF line ends", ok);
+}
+
+static int testMalformedRows()
+{
+  // line 3: bad cell; line 4: short row (no LT of the second trace); line 5: long row
+  const std::string text = "2\nPbWO_1_bef PbWO_1_irr\n800 7x1 800 70\n799 71 799\n798 72 798 69 798 1\n";
+  for (int crlf = 0; crlf < 2; crlf++) {
+    CrystalCSVInfo info;
+    CrystalSpectra spectra;
+    testParse(crlf ? testCRLF(text) : text, info, spectra);
+    bool ok = info.nrow == 3 && info.nbad == 1;
+    ok = ok && std::isnan(spectra[0][0]) && spectra[1][0] == 70;
+    ok = ok && spectra[0][1] == 71 && std::isnan(spectra[1][1]);
+    ok = ok && spectra[0][2] == 72 && spectra[1][2] == 69;
+    ok = ok && info.diagnostics.Total() == 3 && info.diagnostics.Count(kDiagBadCell) == 1 &&
+         info.diagnostics.Count(kDiagShortRow) == 1 && info.diagnostics.Count(kDiagLongRow) == 1;
+    ok = ok && testDiag(info, 0, kDiagBadCell, 3, 2) && testDiag(info, 1, kDiagShortRow, 4, 4) &&
+         testDiag(info, 2, kDiagLongRow, 5, 5);
+    if (testResult(crlf ? "bad cell, short and long row (CRLF)" : "bad cell, short and long row", ok)) return 1;
+  }
+  return 0;
+}
+
+static int testMalformedHeader()
+{
+  CrystalCSVInfo info;
+  CrystalSpectra spectra;
+  // trace count not a number, one trace name without a status
+  testParse("two\nPbWO_1_bef PbWO_1\n800 71 800 70\n", info, spectra);
+  bool ok = info.nscanFile == 0 && info.nscan == 2 && info.nrow == 1;
+  ok = ok && info.diagnostics.Count(kDiagBadCount) == 1 && info.diagnostics.Count(kDiagBadName) == 1 &&
+       info.diagnostics.Count(kDiagCountMismatch) == 1;
+  ok = ok && testDiag(info, 0, kDiagBadCount, 1, 1) && testDiag(info, 1, kDiagBadName, 2, 2);
+  ok = ok && spectra.Crystal(1) == 1 && spectra.Status(1) == kStatusUnknown && spectra[1][0] == 70;
+  int failed = testResult("bad trace count and name", ok);
+
+  // count larger than int, crystal number larger than int
+  testParse("99999999999\nPbWO_2147483648_bef\n800 71\n", info, spectra);
+  ok = info.nscanFile == 0 && info.nscan == 1 && spectra.Crystal(0) == -1;
+  ok = ok && info.diagnostics.Count(kDiagBadCount) == 1 && info.diagnostics.Count(kDiagBadName) == 1;
+  failed += testResult("trace count and crystal number overflow", ok);
+  return failed;
+}
+
+static int testParseInt()
+{
+  struct { const char* text; bool ok; int value; } cases[] = {
+    { "2147483647", true, INT_MAX }, { "2147483648", false, 0 }, { "-2147483647", true, -INT_MAX },
+    { "99999999999999999999", false, 0 }, { "+7", true, 7 }, { "007", true, 7 }, { "", false, 0 },
+    { "-", false, 0 }, { "12a", false, 0 }
+  };
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    int value = 0;
+    const char* p = cases[i].text;
+    const bool parsed = crystalParseInt(p, p + std::strlen(p), value);
+    ok = ok && parsed == cases[i].ok && (!parsed || value == cases[i].value);
+  }
+  return testResult("crystalParseInt range", ok);
+}
+
+int main()
+{
+  int nfail = 0;
+  nfail += testLineEnds();
+  nfail += testMalformedRows();
+  nfail += testMalformedHeader();
+  nfail += testParseInt();
+  return nfail ? 1 : 0;
+}
@@ -0,0 +1,98 @@
+// crystal_testCache.cc - Binary sidecar cache of parsed csv files (crystal_cache.h).
+//
+// The first read parses the file and writes the sidecar, the second loads it with the same spectra
+// and diagnostics; an edit that keeps the file size, and a damaged sidecar, must both fall back to
+// parsing. A cache directory that cannot be written flags the first file only and stops the writes
+// of later reads. Exit code 0 if every case passes. ROOT-free:
+//
+//   make check
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "crystal_cache.h"
+#include "crystal_csvReader.h"
+#include "crystal_spectra.h"
+
+
+static void testWrite(const std::string& path, const char* text)
+{
+  FILE* f = std::fopen(path.c_str(), "w");
+  std::fputs(text, f);
+  std::fclose(f);
+}
+
+static bool testSame(const CrystalSpectra& a, const CrystalSpectra& b)
+{
+  if (a.NScans() != b.NScans() || a.NWavelengths() != b.NWavelengths()) return false;
+  for (int j = 0; j < a.NWavelengths(); j++)
+    if (a.WL()[j] != b.WL()[j]) return false;
+  for (int i = 0; i < a.NScans(); i++) {
+    if (a.Crystal(i) != b.Crystal(i) || a.Status(i) != b.Status(i)) return false;
+    for (int j = 0; j < a.NWavelengths(); j++)
+      if (!(a[i][j] == b[i][j] || (std::isnan(a[i][j]) && std::isnan(b[i][j])))) return false;
+  }
+  return true;
+}
+
+static int testResult(const char* name, bool ok)
+{
+  std::printf("%-36s %s\n", name, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main()
+{
+  const std::string dir = "/tmp/crystal_testCache_" + std::to_string((long)::getpid());
+  ::mkdir(dir.c_str(), 0755);
+  const std::string csv = dir + "/box.csv";
+  const CrystalCacheConfig cache(true, dir);
+  const std::string sidecar = crystalCachePath(csv, cache);
+  // one bad cell, so the diagnostics go through the sidecar too
+  testWrite(csv, "2\nPbWO_5_bef PbWO_5_irr\n800 71.5 800 70.25\n799 7x 799 69.5\n");
+
+  int nfail = 0;
+  CrystalCSVInfo parsed, loaded;
+  CrystalSpectra first, second;
+  bool ok = readGiessenCSVCached(csv.c_str(), parsed, first, cache) && !parsed.cached && ::access(sidecar.c_str(), F_OK) == 0;
+  nfail += testResult("miss: parsed, sidecar written", ok);
+
+  ok = readGiessenCSVCached(csv.c_str(), loaded, second, cache) && loaded.cached && testSame(first, second);
+  ok = ok && loaded.nscanFile == parsed.nscanFile && loaded.nrow == parsed.nrow && loaded.nbad == 1;
+  ok = ok && loaded.diagnostics.Count(kDiagBadCell) == 1 && loaded.diagnostics.NStored() == 1 &&
+       loaded.diagnostics.Get(0).line == 4 && loaded.diagnostics.Get(0).column == 2;
+  nfail += testResult("hit: same spectra and diagnostics", ok);
+
+  // same size, one value changed
+  testWrite(csv, "2\nPbWO_5_bef PbWO_5_irr\n800 71.5 800 70.75\n799 7x 799 69.5\n");
+  CrystalCSVInfo edited;
+  CrystalSpectra third;
+  ok = readGiessenCSVCached(csv.c_str(), edited, third, cache) && !edited.cached && third[1][0] == 70.75;
+  nfail += testResult("file edited: parsed again", ok);
+  CrystalCSVInfo again;
+  ok = readGiessenCSVCached(csv.c_str(), again, third, cache) && again.cached && third[1][0] == 70.75;
+  nfail += testResult("edited file: sidecar rewritten", ok);
+
+  // damaged sidecar: cut short
+  ::truncate(sidecar.c_str(), 40);
+  CrystalCSVInfo damaged;
+  ok = readGiessenCSVCached(csv.c_str(), damaged, third, cache) && !damaged.cached && third[1][0] == 70.75;
+  nfail += testResult("damaged sidecar: parsed again", ok);
+
+  // missing cache directory: parsed every time, the failure reported once
+  const CrystalCacheConfig missing(true, dir + "/missing");
+  CrystalCSVInfo fail1, fail2;
+  ok = readGiessenCSVCached(csv.c_str(), fail1, third, missing) && fail1.cacheWriteFailed && missing.readOnly;
+  ok = ok && readGiessenCSVCached(csv.c_str(), fail2, third, missing) && !fail2.cacheWriteFailed && !fail2.cached;
+  ok = ok && !cache.readOnly && third[1][0] == 70.75;
+  nfail += testResult("unwritable directory: one warning", ok);
+
+  std::remove(sidecar.c_str());
+  std::remove(csv.c_str());
+  ::rmdir(dir.c_str());
+  return nfail ? 1 : 0;
+}
@@ -0,0 +1,63 @@
+// crystal_testCorrection.cc - Baseline, reference and scale correction (crystal_correction.h).
+//
+// The folded gain and bias applied by Apply() must match LT_corr = scale * 100 * (LT - baseline) /
+// (reference - baseline) at every point, with the curves sampled on grids of their own; points the
+// curves do not cover, and points with reference <= baseline, must be NaN. Exit code 0 if every case
+// passes. ROOT-free:
+//
+//   make check
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "crystal_correction.h"
+#include "crystal_spectra.h"
+
+
+// Linear curve a + b wl from "from" to "to" nm in steps of step (descending if step < 0)
+static CrystalCurve testCurve(double a, double b, double from, double to, double step)
+{
+  CrystalCurve curve;
+  for (double w = from; step > 0 ? w <= to + 1e-9 : w >= to - 1e-9; w += step) {
+    curve.wl.push_back(w);
+    curve.value.push_back(a + b * w);
+  }
+  return curve;
+}
+
+int main()
+{
+  const int nscan = 5, nwl = 301;   // 800 ... 200 nm
+  CrystalSpectra raw;
+  raw.Resize(nscan, nwl);
+  for (int j = 0; j < nwl; j++) raw.WL()[j] = 800 - 2 * j;
+  for (int i = 0; i < nscan; i++)
+    for (int j = 0; j < nwl; j++) raw[i][j] = 20 + 10 * i + 0.05 * raw.WL()[j];
+
+  // the baseline covers 220-800 nm only; the reference is at or below it under 248 nm
+  CrystalCorrection correction;
+  correction.SetBaseline(testCurve(1, 0.002, 220, 800, 5));
+  correction.SetReference(testCurve(-91.5, 0.375, 800, 200, -10));
+  correction.SetScale(testCurve(0.9, 0.0001, 200, 800, 25));
+  CrystalSpectra corrected;
+  bool ok = correction.Build(raw.WL(), nwl) && correction.NWavelengths() == nwl;
+  correction.Apply(raw, corrected, 2);
+  long nnan = 0;
+  for (int i = 0; ok && i < nscan; i++)
+    for (int j = 0; j < nwl; j++) {
+      const double w = raw.WL()[j];
+      const double baseline = 1 + 0.002 * w, reference = -91.5 + 0.375 * w, scale = 0.9 + 0.0001 * w;
+      const double v = corrected[i][j];
+      if (w < 220 || reference <= baseline) {
+        ok = ok && std::isnan(v);
+        nnan++;
+        continue;
+      }
+      const double expect = scale * 100 * (raw[i][j] - baseline) / (reference - baseline);
+      ok = ok && std::fabs(v - expect) <= 1e-9 * std::fabs(expect);
+    }
+  ok = ok && nnan == nscan * 24;   // 200-246 nm
+  std::printf("baseline, reference and scale on %d scans: %s\n", nscan, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,68 @@
+// crystal_testDeltaK.cc - Vectorised deltaK (crystal_deltaK.h) against the scalar definition.
+//
+// deltaK = (1/L) ln(bef/irr) and ratio = irr/bef at every point of random spectra, with zero,
+// negative and NaN transmissions mixed in; those points must be NaN in both tables and counted.
+// Exit code 0 if every value agrees to a few ulp. ROOT-free:
+//
+//   make check
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "crystal_deltaK.h"
+#include "crystal_spectra.h"
+
+
+int main()
+{
+  const int npair = 7, nwl = 1001;   // odd length: vector loop remainders
+  const double length = 0.2;
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  std::mt19937_64 rng(12345);
+  std::uniform_real_distribution<double> lt(0.5, 90.);
+  std::uniform_int_distribution<int> bad(0, 49);
+
+  CrystalSpectra spectra;
+  spectra.Resize(2 * npair, nwl);
+  std::vector<CrystalPair> pairs;
+  for (int ip = 0; ip < npair; ip++) {
+    // pairs in reverse order of their scans, irr before bef
+    CrystalPair pair = { ip, 2 * (npair - 1 - ip) + 1, 2 * (npair - 1 - ip) };
+    pairs.push_back(pair);
+  }
+  for (int i = 0; i < spectra.NScans(); i++)
+    for (int j = 0; j < nwl; j++) {
+      const int b = bad(rng);
+      spectra[i][j] = b == 0 ? 0. : b == 1 ? -1. : b == 2 ? nan : lt(rng);
+    }
+
+  CrystalDeltaK deltaK;
+  deltaK.Compute(spectra, pairs, length);
+  bool ok = deltaK.NPairs() == npair && deltaK.NWavelengths() == nwl;
+  long ninvalid = 0, nbad = 0;
+  double worst = 0;
+  for (int ip = 0; ok && ip < npair; ip++) {
+    const double* bef = spectra[pairs[ip].before];
+    const double* irr = spectra[pairs[ip].after];
+    for (int j = 0; j < nwl; j++) {
+      const double dk = deltaK.DeltaK(ip)[j], ratio = deltaK.Ratio(ip)[j];
+      if (!(bef[j] > 0 && irr[j] > 0)) {
+        ninvalid++;
+        nbad += !(std::isnan(dk) && std::isnan(ratio));
+        continue;
+      }
+      const double expect = (1. / length) * std::log(bef[j] / irr[j]);
+      const double err = std::fabs(dk - expect) / std::max(std::fabs(expect), 1.);
+      worst = std::max(worst, err);
+      nbad += !(err <= 1e-14) || ratio != irr[j] / bef[j];
+    }
+  }
+  ok = ok && nbad == 0 && deltaK.NInvalid() == ninvalid && ninvalid > 0;
+  std::printf("%d pairs x %d wavelengths, %ld invalid points, worst relative error %.1e: %s\n", npair, nwl, ninvalid,
+              worst, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+// crystal_testHistory.cc - Multi-campaign history file (crystal_history.h).
+//
+// Two campaigns on different grids are appended in two sessions; the lookup of one crystal must
+// return all its scans in ingest order (with the LT of each on its campaign grid), the status filter
+// must select within them, and the index written at Close() must serve a read-only session.
+// Exit code 0 if every case passes. Needs ROOT:
+//
+//   make check
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "crystal_history.h"
+#include "crystal_spectra.h"
+
+
+// nscan scans of crystals first, first + 1, ... alternating bef/irr, LT = 10 * campaign + scan
+static CrystalSpectra testCampaign(int campaign, int nwl, int nscan, int first)
+{
+  CrystalSpectra spectra;
+  spectra.Resize(nscan, nwl);
+  spectra.SetFileName("campaign" + std::to_string(campaign) + ".csv");
+  for (int j = 0; j < nwl; j++) spectra.WL()[j] = 800 - j;
+  for (int i = 0; i < nscan; i++) {
+    spectra.SetScan(i, first + i / 2, i % 2 ? kStatusIrr : kStatusBef);
+    for (int j = 0; j < nwl; j++) spectra[i][j] = 10 * campaign + i;
+  }
+  return spectra;
+}
+
+static int testResult(const char* name, bool ok)
+{
+  std::printf("%-36s %s\n", name, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main()
+{
+  const std::string path = "/tmp/crystal_testHistory_" + std::to_string((long)::getpid()) + ".root";
+  int nfail = 0;
+  {
+    CrystalHistoryDB db;
+    bool ok = db.Open(path) && db.Append("round 1", testCampaign(1, 5, 6, 7)) == 0;   // crystals 7, 8, 9
+    nfail += testResult("first campaign", ok && db.NCampaigns() == 1 && db.NScans() == 6);
+  }
+  {
+    CrystalHistoryDB db;
+    bool ok = db.Open(path) && db.Append("round 2", testCampaign(2, 8, 4, 8)) == 1;   // crystals 8, 9
+    std::vector<CrystalHistoryScan> scans;
+    ok = ok && db.NCampaigns() == 2 && db.NScans() == 10 && db.History(8, scans) == 4;
+    ok = ok && scans[0].campaign == 0 && scans[0].status == kStatusBef && scans[0].lt.size() == 5 && scans[0].lt[0] == 12;
+    ok = ok && scans[1].campaign == 0 && scans[1].status == kStatusIrr && scans[1].lt[4] == 13;
+    ok = ok && scans[2].campaign == 1 && scans[2].status == kStatusBef && scans[2].lt.size() == 8 && scans[2].lt[7] == 20;
+    ok = ok && scans[3].campaign == 1 && scans[3].status == kStatusIrr && scans[3].file == "campaign2.csv";
+    nfail += testResult("lookup across campaigns", ok);
+    ok = db.History(9, scans, kStatusIrr) == 2 && scans[0].campaign == 0 && scans[1].campaign == 1 &&
+         db.History(7, scans, kStatusAnn) == 0 && db.History(42, scans) == 0;
+    nfail += testResult("status filter, unknown crystal", ok);
+  }
+  {
+    CrystalHistoryDB db;
+    std::vector<CrystalHistoryScan> scans;
+    CrystalHistoryCampaign campaign;
+    bool ok = db.Open(path) && db.History(7, scans) == 2 && db.GetCampaign(1, campaign);
+    ok = ok && campaign.name == "round 2" && campaign.nscan == 4 && campaign.wl.size() == 8;
+    nfail += testResult("reopened: stored index", ok);
+  }
+  std::remove(path.c_str());
+  return nfail ? 1 : 0;
+}
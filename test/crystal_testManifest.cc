@@ -0,0 +1,73 @@
+// crystal_testManifest.cc - Manifest of the files ingested by incremental runs (crystal_manifest.h).
+//
+// Entries (a path with spaces included) must survive Save/Load unchanged, Set must replace the entry
+// of the same file, a file that is not a manifest must load as empty, and the scan key must change
+// when a crystal number or status of the ingested scans does. Exit code 0 if every case passes.
+// ROOT-free:
+//
+//   make check
+
+#include <cstdio>
+#include <string>
+
+#include <unistd.h>
+
+#include "crystal_manifest.h"
+#include "crystal_spectra.h"
+
+
+static int testResult(const char* name, bool ok)
+{
+  std::printf("%-36s %s\n", name, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+int main()
+{
+  const std::string path = "/tmp/crystal_testManifest_" + std::to_string((long)::getpid()) + ".manifest";
+  CrystalSpectra spectra;
+  spectra.Resize(4, 1);
+  for (int i = 0; i < 4; i++) spectra.SetScan(i, 100 + i / 2, i % 2 ? kStatusIrr : kStatusBef);
+
+  CrystalManifest manifest;
+  manifest.SetSettings("storage double; correction none");
+  CrystalManifestEntry a, b;
+  a.file = "GiessenData/BOX1_PROD.csv"; a.size = 123456789012LL; a.mtime = 1700000000; a.nscan = 4;
+  a.key = crystalManifestScanKey(spectra, 0, 4);
+  b.file = "Giessen Data/box 2.csv";    b.size = 7;              b.mtime = 1700000001; b.nscan = 2;
+  b.key = crystalManifestScanKey(spectra, 0, 2);
+  manifest.Set(a);
+  manifest.Set(b);
+  a.nscan = 3;
+  manifest.Set(a);   // replaces, does not add
+
+  int nfail = 0;
+  CrystalManifest loaded;
+  bool ok = manifest.NFiles() == 2 && manifest.Save(path) && loaded.Load(path);
+  ok = ok && loaded.NFiles() == 2 && loaded.Settings() == manifest.Settings();
+  for (int i = 0; ok && i < 2; i++) {
+    const CrystalManifestEntry& x = manifest.GetEntry(i);
+    const CrystalManifestEntry* y = loaded.Find(x.file);
+    ok = y && y->size == x.size && y->mtime == x.mtime && y->nscan == x.nscan && y->key == x.key;
+  }
+  ok = ok && loaded.Find("GiessenData/BOX1_PROD.csv")->nscan == 3 && !loaded.Find("Giessen");
+  nfail += testResult("save and load, path with spaces", ok);
+
+  FILE* f = std::fopen(path.c_str(), "w");
+  std::fputs("2\nPbWO_1_bef PbWO_1_irr\n", f);
+  std::fclose(f);
+  ok = !loaded.Load(path) && loaded.NFiles() == 0 && loaded.Settings().empty();
+  nfail += testResult("not a manifest: empty", ok);
+
+  const uint64_t key = crystalManifestScanKey(spectra, 0, 4), key3 = crystalManifestScanKey(spectra, 0, 3);
+  spectra.SetScan(3, 101, kStatusAnn);
+  ok = crystalManifestScanKey(spectra, 0, 4) != key && crystalManifestScanKey(spectra, 0, 3) == key3;
+  spectra.SetScan(3, 102, kStatusIrr);
+  ok = ok && crystalManifestScanKey(spectra, 0, 4) != key;
+  spectra.SetScan(3, 101, kStatusIrr);
+  ok = ok && crystalManifestScanKey(spectra, 0, 4) == key;
+  nfail += testResult("scan key follows crystal and status", ok);
+
+  std::remove(path.c_str());
+  return nfail ? 1 : 0;
+}
@@ -0,0 +1,45 @@
+// crystal_testPairing.cc - bef/irr pairing (crystal_pairing.h) with repeated and unknown scans.
+//
+// A crystal scanned twice in the same state keeps its first scan and counts the others as
+// duplicates; scans without a crystal number or state are counted as unknown; pairs come in order of
+// first appearance whatever the order of bef and irr in the file. Exit code 0 if every case passes.
+// ROOT-free:
+//
+//   make check
+
+#include <cstdio>
+#include <vector>
+
+#include "crystal_pairing.h"
+#include "crystal_spectra.h"
+
+
+int main()
+{
+  // crystal, status of each scan
+  const int scans[][2] = {
+    { 1, kStatusBef },  { 1, kStatusIrr }, { 1, kStatusBef },      // 2: duplicate bef
+    { 2, kStatusIrr },  { 2, kStatusBef },                          // irr before bef
+    { 3, kStatusBef },                                              // no irr
+    { 1, kStatusIrr },                                              // 6: duplicate irr
+    { -1, kStatusBef }, { 4, kStatusUnknown },                      // unknown
+    { 4, kStatusAnn },  { 4, kStatusIrr }, { 4, kStatusBef }
+  };
+  const int nscan = sizeof(scans) / sizeof(scans[0]);
+  CrystalSpectra spectra;
+  spectra.Resize(nscan, 1);
+  for (int i = 0; i < nscan; i++) spectra.SetScan(i, scans[i][0], scans[i][1]);
+
+  CrystalPairing pairing(spectra);
+  const std::vector<CrystalPair> pairs = pairing.Pairs();
+  const std::vector<CrystalPair> annealed = pairing.Pairs(kStatusIrr, kStatusAnn);
+  bool ok = pairing.NCrystals() == 4 && pairing.NDuplicates() == 2 && pairing.NUnknown() == 2;
+  ok = ok && pairing.Scan(1, kStatusBef) == 0 && pairing.Scan(1, kStatusIrr) == 1 && pairing.Scan(3, kStatusIrr) == -1;
+  ok = ok && pairs.size() == 3;
+  ok = ok && pairs[0].crystal == 1 && pairs[0].before == 0 && pairs[0].after == 1;
+  ok = ok && pairs[1].crystal == 2 && pairs[1].before == 4 && pairs[1].after == 3;
+  ok = ok && pairs[2].crystal == 4 && pairs[2].before == 11 && pairs[2].after == 10;
+  ok = ok && annealed.size() == 1 && annealed[0].crystal == 4 && annealed[0].before == 10 && annealed[0].after == 9;
+  std::printf("duplicate, unknown and reordered scans: %s\n", ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+// crystal_testQuality.cc - Per-quantity statistics of the acceptance summary (crystal_quality.h).
+//
+// Welford accumulators filled over uneven slices of the crystals and merged, as the worker threads
+// do, must give the counts, mean, RMS, minimum and maximum of a single pass, and both must agree
+// with a two-pass computation. Broken crystals that fail with a NaN value count as tested and failed
+// but stay out of the mean. Exit code 0 if every case passes. ROOT-free:
+//
+//   make check
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "crystal_quality.h"
+
+
+static bool testClose(double a, double b, double tolerance = 1e-12)
+{
+  return std::fabs(a - b) <= tolerance * std::max(std::fabs(a), std::fabs(b));
+}
+
+static int testResult(const char* name, bool ok)
+{
+  std::printf("%-36s %s\n", name, ok ? "ok" : "FAIL");
+  return ok ? 0 : 1;
+}
+
+// Two good crystals, two broken ones (fail, NaN) and an untested one, split over two slots
+static int testBroken()
+{
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  CrystalQuantityStats a, b;
+  a.Add(64., kQualityPass);
+  a.Add(nan, kQualityFail);
+  b.Add(nan, kQualityFail);
+  b.Add(66., kQualityFail);
+  b.Add(nan, kQualityUntested);
+  CrystalQuantityStats merged;
+  merged.Merge(a);
+  merged.Merge(b);
+  bool ok = true;
+  const CrystalQuantityStats* s[3] = { &a, &b, &merged };
+  for (int k = 0; k < 3; k++) ok = ok && s[k]->npass + s[k]->nfail == s[k]->ntested;
+  ok = ok && merged.ntested == 4 && merged.nfail == 3 && merged.nvalues == 2;
+  ok = ok && merged.mean == 65. && testClose(merged.RMS(), std::sqrt(2.)) && merged.min == 64. && merged.max == 66.;
+  return testResult("broken crystals: counts and values", ok);
+}
+
+int main()
+{
+  // LT-like values far from zero, where a naive sum of squares would lose digits
+  const int n = 10007;
+  std::mt19937_64 rng(2024);
+  std::normal_distribution<double> value(65., 0.8);
+  std::vector<double> x(n);
+  std::vector<int> status(n);
+  for (int i = 0; i < n; i++) {
+    x[i] = value(rng);
+    status[i] = x[i] >= 65. ? kQualityPass : kQualityFail;
+  }
+
+  CrystalQuantityStats single;
+  for (int i = 0; i < n; i++) single.Add(x[i], status[i]);
+
+  // slices of 0, 1, 2, ... crystals and the rest, merged in order (an empty slice included)
+  CrystalQuantityStats merged;
+  for (int begin = 0, len = 0; begin < n; begin += len, len++) {
+    CrystalQuantityStats slice;
+    for (int i = begin; i < std::min(n, begin + len); i++) slice.Add(x[i], status[i]);
+    merged.Merge(slice);
+  }
+
+  double mean = 0, m2 = 0, vmin = x[0], vmax = x[0];
+  long npass = 0;
+  for (int i = 0; i < n; i++) {
+    mean += x[i] / n;
+    vmin = std::min(vmin, x[i]);
+    vmax = std::max(vmax, x[i]);
+    npass += status[i] == kQualityPass;
+  }
+  for (int i = 0; i < n; i++) m2 += (x[i] - mean) * (x[i] - mean);
+  const double rms = std::sqrt(m2 / (n - 1));
+
+  bool ok = true;
+  const CrystalQuantityStats* s[2] = { &single, &merged };
+  for (int k = 0; k < 2; k++) {
+    ok = ok && s[k]->ntested == n && s[k]->nvalues == n && s[k]->npass == npass && s[k]->nfail == n - npass;
+    ok = ok && testClose(s[k]->mean, mean) && testClose(s[k]->RMS(), rms, 1e-10);
+    ok = ok && s[k]->min == vmin && s[k]->max == vmax;
+  }
+  ok = ok && testClose(merged.mean, single.mean) && testClose(merged.m2, single.m2, 1e-10);
+  std::printf("Welford merge of %d values: mean %.12g rms %.12g (two-pass %.12g %.12g): %s\n", n, merged.mean,
+              merged.RMS(), mean, rms, ok ? "ok" : "FAIL");
+  int nfail = ok ? 0 : 1;
+  nfail += testBroken();
+  return nfail ? 1 : 0;
+}
@@ -0,0 +1,80 @@
+// crystal_testStorage.cc - Round trip of LT values through the "crystals" tree in every storage mode.
+//
+// Writes one scan with a NaN cell, values at and beyond the fixed-point range and a typical LT with
+// CrystalTreeWriter (crystal_treeWriter.h), reads it back with readCrystalTree (crystal_treeReader.h)
+// and checks that NaN stays NaN and every other value is within CrystalTreeConfig::StorageError().
+// Exit code 0 if every mode passes. Needs ROOT:
+//
+//   make check
+
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "crystal_spectra.h"
+#include "crystal_treeReader.h"
+#include "crystal_treeWriter.h"
+
+
+static int testStorage(const char* mode)
+{
+  CrystalTreeConfig config(("/tmp/crystal_testStorage_" + std::to_string((long)::getpid()) + ".root").c_str());
+  if (!crystalParseStorage(mode, config)) {
+    std::printf("%-16s bad storage mode\n", mode);
+    return 1;
+  }
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+  // NaN, typical LT, fixed range ends and beyond, one value in the reserved top step
+  const std::vector<double> lt = { nan, 67.123456, -10, 110, -25, 130, 109.999, 0 };
+  const int nwl = lt.size();
+  std::vector<double> wl(nwl);
+  for (int i = 0; i < nwl; i++) wl[i] = 300 + i;
+  {
+    CrystalTreeWriter writer(config, wl.data(), nwl, std::vector<std::string>(1, "test.csv"));
+    if (!writer.IsOpen()) {
+      std::printf("%-16s output could not be opened\n", mode);
+      return 1;
+    }
+    writer.Fill(123, kStatusBef, lt.data());
+  }
+  CrystalSpectra spectra;
+  const bool read = readCrystalTree(config.fileName, spectra);
+  std::remove(config.fileName.c_str());
+  if (!read || spectra.NScans() != 1 || spectra.NWavelengths() != nwl) {
+    std::printf("%-16s tree could not be read back\n", mode);
+    return 1;
+  }
+
+  // values the mode can represent: fixed point clamps to [min, max - step]
+  const double lo = config.storage == kStorageFixed ? config.fixedMin : -HUGE_VAL;
+  const double hi = config.storage == kStorageFixed ? config.fixedMax - config.FixedStep() : HUGE_VAL;
+  int nfail = 0;
+  for (int i = 0; i < nwl; i++) {
+    const double got = spectra[0][i];
+    bool ok;
+    if (std::isnan(lt[i])) ok = std::isnan(got);
+    else {
+      const double want = lt[i] < lo ? lo : lt[i] > hi ? hi : lt[i];
+      const double bound = config.storage == kStorageFloat ? config.StorageError() * std::fabs(want) : config.StorageError();
+      ok = !std::isnan(got) && std::fabs(got - want) <= bound * (1 + 1e-9) + 1e-12;
+    }
+    if (!ok) {
+      std::printf("%-16s value %d: wrote %g, read %g\n", mode, i, lt[i], got);
+      nfail++;
+    }
+  }
+  std::printf("%-16s %s\n", mode, nfail ? "FAIL" : "ok");
+  return nfail ? 1 : 0;
+}
+
+int main()
+{
+  int nfail = 0;
+  const char* modes[] = { "double", "float", "fixed", "fixed:12:0:100", "fixed:24" };
+  for (const char* mode : modes) nfail += testStorage(mode);
+  return nfail ? 1 : 0;
+}
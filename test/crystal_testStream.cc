@@ -0,0 +1,73 @@
+// crystal_testStream.cc - Memory budget boundary of the streaming reader (crystal_stream.h).
+//
+// With a budget of exactly R rows per row block, a file of R rows (with or without trailing blank
+// lines) must be held in memory, and a file of R + 1 rows must spill; both must hand out the same
+// LT values as the in-memory parser (crystal_csvReader.h). A last case alters one reference value
+// and must report the mismatch, so the comparison itself is tested. Exit code 0 if every case passes.
+// ROOT-free:
+//
+//   make check
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "crystal_csvReader.h"
+#include "crystal_spectra.h"
+#include "crystal_stream.h"
+
+
+static std::string testWriteFile(int nscan, int nrow, int nblank)
+{
+  const std::string path = "/tmp/crystal_testStream_" + std::to_string((long)::getpid()) + ".csv";
+  FILE* f = std::fopen(path.c_str(), "w");
+  std::fprintf(f, "%d\n", nscan);
+  for (int i = 0; i < nscan; i++) std::fprintf(f, "%sPbWO_%d_%s", i ? " " : "", i / 2, i % 2 ? "irr" : "bef");
+  std::fprintf(f, "\n");
+  for (int r = 0; r < nrow; r++) {
+    for (int i = 0; i < nscan; i++) std::fprintf(f, "%s%g %g", i ? " " : "", 900. - r, 10. * i + 0.01 * r);
+    std::fprintf(f, "\n");
+  }
+  for (int k = 0; k < nblank; k++) std::fprintf(f, "\n");
+  std::fclose(f);
+  return path;
+}
+
+// corrupt: change the last reference value first; the case then passes only if the mismatch is seen
+static int testBoundary(int nrow, int nblank, bool spill, bool corrupt = false)
+{
+  const int nscan = 6, blockRows = 8;
+  const std::string path = testWriteFile(nscan, nrow, nblank);
+  CrystalStreamReader stream(CrystalStreamConfig(2 * blockRows * nscan * sizeof(double)));
+  CrystalCSVInfo info;
+  CrystalSpectra ref;
+  bool ok = stream.Open(path.c_str()) && readGiessenCSV(path.c_str(), info, ref);
+  ok = ok && stream.Spilled() == spill && stream.NScans() == nscan && stream.NWavelengths() == nrow;
+  if (ok && corrupt) ref[nscan - 1][nrow - 1] += 1.;
+  bool same = true;
+  ok = ok && stream.ForEachBlock([&](int first, const CrystalSpectra& block) {
+      for (int i = 0; i < block.NScans(); i++)
+        for (int j = 0; j < nrow; j++) same = same && block[i][j] == ref[first + i][j];
+    });
+  ok = ok && same != corrupt;
+  std::remove(path.c_str());
+  std::printf("%d rows + %d blank, block of %d rows%s: %s %s\n", nrow, nblank, blockRows,
+              corrupt ? ", one reference value changed" : "", stream.Spilled() ? "spilled" : "in memory",
+              !ok ? "FAIL" : corrupt ? "mismatch found, ok" : "ok");
+  return ok ? 0 : 1;
+}
+
+int main()
+{
+  int nfail = 0;
+  nfail += testBoundary(7, 0, false);
+  nfail += testBoundary(8, 0, false);
+  nfail += testBoundary(8, 3, false);
+  nfail += testBoundary(9, 0, true);
+  nfail += testBoundary(17, 1, true);
+  nfail += testBoundary(17, 1, true, true);
+  return nfail ? 1 : 0;
+}